@@ -0,0 +1,92 @@
+#!/usr/bin/env bash
+# Training throughput and multi-thread scaling on a synthetic corpus (no download needed).
+# Runs multivec-mono, multivec-bi and word2vec for each combination of CBOW/skip-gram, hierarchical
+# softmax/negative sampling, dimension and number of threads, and reports the training speed
+# (corpus words per second, per thread, and scaling efficiency w.r.t. 1 thread) and the peak memory.
+#
+# Run from the root directory of the project, after building. Parameters are set with environment
+# variables, e.g.: LINES=1000000 MAX_THREADS=64 DIMENSIONS="100 300" ./benchmarks/throughput.sh
+
+lines=${LINES:-200000}              # number of lines of the synthetic corpus (20 words per line on average)
+vocab_size=${VOCAB_SIZE:-100000}    # number of distinct words (Zipf distribution)
+max_threads=${MAX_THREADS:-`nproc`}
+dimensions=${DIMENSIONS:-"100 300"}
+iterations=${ITER:-1}
+output=${OUTPUT:-${TMPDIR:-/tmp}/multivec-throughput}  # results directory (outside of the source tree)
+
+mkdir -p $output
+tmp_dir=`mktemp -d`
+trap "rm -rf $tmp_dir" EXIT
+
+corpus=$tmp_dir/corpus.src
+corpus_trg=$tmp_dir/corpus.trg
+bin/multivec-bench --write-corpus $corpus --lines $lines --vocab-size $vocab_size --seed 1
+bin/multivec-bench --write-corpus $corpus_trg --lines $lines --vocab-size $vocab_size --seed 2
+words=`wc -w < $corpus`
+words_trg=`wc -w < $corpus_trg`
+
+thread_counts=""
+for ((t = 1; t < max_threads; t *= 2)); do thread_counts="$thread_counts $t"; done
+thread_counts="$thread_counts $max_threads"
+
+results=$output/results.tsv
+echo -e "program\tmodel\toutput\tdimension\tthreads\twords/s\twords/s/thread\tefficiency\tpeak MB" | tee $results
+
+# $1: JSON file, $2: key
+json_value() {
+    grep -o "\"$2\": [0-9.]*" $1 | head -n1 | sed 's/.*: //'
+}
+
+# $1: program, $2: total number of words (all epochs), $3: training time, $4: peak memory in bytes (or NA)
+report() {
+    speed=`awk "BEGIN { print $2 / $3 }"`
+    if [ $threads -eq 1 ]; then base_speed=$speed; fi
+    awk -v program=$1 -v model=$model -v layer=$layer -v dimension=$dimension -v threads=$threads \
+        -v speed=$speed -v base_speed=$base_speed -v memory=$4 'BEGIN {
+        if (memory != "NA") memory = sprintf("%.0f", memory / 1048576)
+        printf "%s\t%s\t%s\t%d\t%d\t%.0f\t%.0f\t%.2f\t%s\n", program, model, layer, dimension, threads,
+            speed, speed / threads, speed / threads / base_speed, memory
+    }' | tee -a $results
+}
+
+# peak memory of a command (in bytes), if GNU time is available
+peak_memory() {
+    if [ -x /usr/bin/time ]; then
+        /usr/bin/time -f "%M" -o $tmp_dir/time.txt "$@" > $tmp_dir/log.txt
+        echo $((`tail -n1 $tmp_dir/time.txt` * 1024))
+    else
+        "$@" > $tmp_dir/log.txt
+        echo NA
+    fi
+}
+
+for model in cbow sg; do
+    for layer in hs ns; do
+        for dimension in $dimensions; do
+            args="--dimension $dimension --iter $iterations --min-count 5"
+            if [ $model = sg ]; then args="$args --sg"; fi
+            if [ $layer = hs ]; then args="$args --hs --negative 0"; else args="$args --negative 5"; fi
+
+            for program in multivec-mono multivec-bi word2vec; do
+                for threads in $thread_counts; do
+                    case $program in
+                    multivec-mono)
+                        bin/multivec-mono --train $corpus $args --threads $threads --stats $tmp_dir/stats.json > $tmp_dir/log.txt
+                        report $program $((words * iterations)) `json_value $tmp_dir/stats.json train` \
+                            `json_value $tmp_dir/stats.json peak_rss`;;
+                    multivec-bi)
+                        bin/multivec-bi --train-src $corpus --train-trg $corpus_trg $args --threads $threads \
+                            --stats $tmp_dir/stats.json > $tmp_dir/log.txt
+                        report $program $(((words + words_trg) * iterations)) `json_value $tmp_dir/stats.json train` \
+                            `json_value $tmp_dir/stats.json peak_rss`;;
+                    word2vec)
+                        memory=`peak_memory bin/word2vec --train $corpus $args --threads $threads --save-vectors-bin $tmp_dir/vectors.bin`
+                        report $program $((words * iterations)) `grep "Training time" $tmp_dir/log.txt | sed 's/.*: //'` $memory;;
+                    esac
+                done
+            done
+        done
+    done
+done
+
+echo "Results written to $results"
@@ -1,9 +1,15 @@
+import os
 from distutils.core import setup, Extension
 from Cython.Build import cythonize
 import numpy
 
-sources = ["multivec.pyx", "../multivec/monolingual.cpp", "../multivec/bilingual.cpp", "../multivec/distance.cpp"]
+sources = ["multivec.pyx", "../multivec/monolingual.cpp", "../multivec/bilingual.cpp", "../multivec/distance.cpp",
+           "../multivec/kernels.cpp", "../multivec/sampler.cpp", "../multivec/corpus.cpp",
+           "../multivec/vocabulary.cpp", "../multivec/stats.cpp"]
 module = Extension("multivec", sources, undef_macros=['NDEBUG'], language="c++")
 module.extra_compile_args = ['--std=c++11', '-w', '-I../multivec', '-O3']
 module.libraries = ['m']
+if os.environ.get('MULTIVEC_BLAS'):  # same as the CMake option, e.g.: MULTIVEC_BLAS=openblas python setup.py ...
+    module.define_macros = [('MULTIVEC_BLAS', None)]
+    module.libraries.append(os.environ['MULTIVEC_BLAS'])
 setup(name="multivec", version="1.0", ext_modules=cythonize([module]), include_dirs=[numpy.get_include()])
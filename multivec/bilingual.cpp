@@ -4,34 +4,98 @@
 void BilingualModel::train(const string& src_file, const string& trg_file, bool initialize) {
     std::cout << "Training files: " << src_file << ", " << trg_file << std::endl;
 
+    stats.clear();
+    Timer timer;
+
     if (initialize) {
         if (config->verbose)
             std::cout << "Creating new model" << std::endl;
 
-        src_model.readVocab(src_file);
-        trg_model.readVocab(trg_file);
-        src_model.initNet();
-        trg_model.initNet();
+        // both vocabularies are counted at the same time (errors are rethrown in this thread)
+        exception_ptr trg_error;
+        thread trg_thread([&]() {
+            try {
+                trg_model.readVocab(trg_file);
+            } catch (...) {
+                trg_error = current_exception();
+            }
+        });
+
+        try {
+            src_model.readVocab(src_file);
+        } catch (...) {
+            trg_thread.join();
+            throw;
+        }
+        trg_thread.join();
+        if (trg_error)
+            rethrow_exception(trg_error);
+        stats.addPhase("vocab", timer.seconds());
+
+        timer.reset();
+        src_model.initNet(multivec::WEIGHTS_STREAM);
+        trg_model.initNet(multivec::TRG_WEIGHTS_STREAM); // different initialization than the source model
+        stats.addPhase("init", timer.seconds());
     } else {
         // TODO: check that initialization is fine
     }
 
-    words_processed = 0;
-    alpha = config->learning_rate;
+    // the training threads all read from the same memory mappings of the files (or of their pre-tokenized versions)
+    timer.reset();
+    unique_ptr<MappedFile> src_corpus, trg_corpus;
+    if (config->train_ids) {
+        src_corpus = src_model.openIds(src_file);
+        trg_corpus = trg_model.openIds(trg_file);
+    }
+
+    bool pretokenized = src_corpus && trg_corpus;
+    if (!pretokenized) {
+        src_corpus.reset(new MappedFile(src_file));
+        trg_corpus.reset(new MappedFile(trg_file));
+    }
+
+    // read files to find out the beginning of each block
+    // the target blocks start at the same lines as the source blocks
+    int n_blocks = trainingBlocks(src_corpus->size(), config->threads);
+    auto src_chunks = src_model.chunkify(*src_corpus, pretokenized, src_file, n_blocks);
+    auto trg_ranges = trg_model.chunkify(*trg_corpus, pretokenized, trg_file, n_blocks);
+    auto trg_chunks = alignCorpus(*trg_corpus, pretokenized, trg_ranges, src_chunks);
+    stats.addPhase("chunkify", timer.seconds());
+
+    timer.reset();
+    if (src_model.sampler.method() != config->sampler)
+        src_model.initUnigramTable();
+    if (trg_model.sampler.method() != config->sampler)
+        trg_model.initUnigramTable();
+    if (src_model.subsampling_rate != config->subsampling)
+        src_model.initSubsampling();
+    if (trg_model.subsampling_rate != config->subsampling)
+        trg_model.initSubsampling();
+    src_model.initSigmoidTable();
+    trg_model.initSigmoidTable();
+    stats.addPhase("init", timer.seconds());
 
-    // read files to find out the beginning of each chunk
-    auto src_chunks = src_model.chunkify(src_file, config->threads);
-    auto trg_chunks = trg_model.chunkify(trg_file, config->threads);
+    long long training_words = src_model.training_words + trg_model.training_words;
+    TrainingProgress progress(config->threads, config->iterations, n_blocks, config->iterations * training_words,
+                              config->learning_rate);
+    stats.threads.resize(config->threads);
+    if (config->verbose)
+        progress.startReporter();
 
     high_resolution_clock::time_point start = high_resolution_clock::now();
+    atomic<long long> next_job(0);
+    ChunkTrainer train_chunk = chunkTrainer();
     if (config->threads == 1) {
-        trainChunk(src_file, trg_file, src_chunks, trg_chunks, 0);
+        trainThread(*src_corpus, *trg_corpus, pretokenized, src_chunks, trg_chunks, 0, next_job, progress,
+                    train_chunk);
     } else {
         vector<thread> threads;
 
         for (int i = 0; i < config->threads; ++i) {
-            threads.push_back(thread(&BilingualModel::trainChunk, this,
-                src_file, trg_file, src_chunks, trg_chunks, i));
+            threads.push_back(thread(&BilingualModel::trainThread, this,
+                std::cref(*src_corpus), std::cref(*trg_corpus), pretokenized,
+                std::cref(src_chunks), std::cref(trg_chunks), i, std::ref(next_job), std::ref(progress),
+                train_chunk));
         }
 
         for (auto it = threads.begin(); it != threads.end(); ++it) {
@@ -41,217 +105,262 @@ void BilingualModel::train(const string& src_file, const string& trg_file, bool
     high_resolution_clock::time_point end = high_resolution_clock::now();
     auto duration = duration_cast<microseconds>(end - start).count();
 
-    if (config->verbose)
+    if (config->verbose) {
+        progress.stopReporter();
         std::cout << std::endl;
+    }
+
+    stats.addPhase("train", static_cast<double>(duration) / 1000000);
+    stats.epochs = progress.epochDurations();
 
     std::cout << "Training time: " << static_cast<float>(duration) / 1000000 << std::endl;
 }
 
-void BilingualModel::trainChunk(const string& src_file,
-                                const string& trg_file,
-                                const vector<long long>& src_chunks,
-                                const vector<long long>& trg_chunks,
-                                int chunk_id) {
-    ifstream src_infile(src_file);
-    ifstream trg_infile(trg_file);
-
-    try {
-        check_is_open(src_infile, src_file);
-        check_is_open(trg_infile, trg_file);
-        check_is_non_empty(src_infile, src_file);
-        check_is_non_empty(trg_infile, trg_file);
-    } catch (...) {
-        throw;
+/**
+ * @brief Training loop of a thread: same as MonolingualModel::trainThread, with aligned blocks
+ * of the source and target corpora.
+ */
+void BilingualModel::trainThread(const MappedFile& src_corpus,
+                                 const MappedFile& trg_corpus,
+                                 bool pretokenized,
+                                 const vector<Chunk>& src_chunks,
+                                 const vector<Chunk>& trg_chunks,
+                                 int thread_id,
+                                 atomic<long long>& next_job,
+                                 TrainingProgress& progress,
+                                 ChunkTrainer train_chunk) {
+    ThreadState state(config->dimension, multivec::Random(config->seed, multivec::TRAINING_STREAM + thread_id),
+                      thread_id);
+    long long n_jobs = static_cast<long long>(config->iterations) * src_chunks.size();
+
+    for (long long job = next_job++; job < n_jobs; job = next_job++) {
+        progress.blockStarted(job);
+        size_t block = job % src_chunks.size();
+        (this->*train_chunk)(src_corpus, trg_corpus, pretokenized, src_chunks[block], trg_chunks[block], state,
+                             progress);
+        progress.blockDone(job);
     }
-    
-    float starting_alpha = config->learning_rate;
-    int max_iterations = config->iterations;
-    long long training_words = src_model.training_words + trg_model.training_words;
-
-    for (int k = 0; k < max_iterations; ++k) {
-        int word_count = 0, last_count = 0;
 
-        src_infile.clear();
-        trg_infile.clear();
-        src_infile.seekg(src_chunks[chunk_id], src_infile.beg);
-        trg_infile.seekg(trg_chunks[chunk_id], trg_infile.beg);
-
-        string src_sent, trg_sent;
-        while (getline(src_infile, src_sent) && getline(trg_infile, trg_sent)) {
-            word_count += trainSentence(src_sent, trg_sent);
-
-            // update learning rate
-            if (word_count - last_count > 10000) {
-                words_processed += word_count - last_count; // asynchronous update
-                last_count = word_count;
-
-                alpha = starting_alpha * (1 - static_cast<float>(words_processed) / (max_iterations * training_words));
-                alpha = std::max(alpha, starting_alpha * 0.0001f);
+    state.stats.words = state.word_count;
+    stats.threads[thread_id] = state.stats;
+}
 
-                if (config->verbose) {
-                    printf("\rAlpha: %f  Progress: %.2f%%", alpha, 100.0 * words_processed /
-                                    (max_iterations * training_words));
-                    fflush(stdout);
-                }
-            }
+BilingualModel::ChunkTrainer BilingualModel::chunkTrainer() const {
+    static const ChunkTrainer trainers[] = {
+        &BilingualModel::trainChunk<TrainingMode<false, false, false>>,
+        &BilingualModel::trainChunk<TrainingMode<false, false, true>>,
+        &BilingualModel::trainChunk<TrainingMode<false, true, false>>,
+        &BilingualModel::trainChunk<TrainingMode<false, true, true>>,
+        &BilingualModel::trainChunk<TrainingMode<true, false, false>>,
+        &BilingualModel::trainChunk<TrainingMode<true, false, true>>,
+        &BilingualModel::trainChunk<TrainingMode<true, true, false>>,
+        &BilingualModel::trainChunk<TrainingMode<true, true, true>>
+    };
+
+    if (config->batch && config->skip_gram && config->negative > 0) {
+        return config->hierarchical_softmax ? &BilingualModel::trainChunk<TrainingMode<true, true, true, true>>
+                                            : &BilingualModel::trainChunk<TrainingMode<true, false, true, true>>;
+    }
+    return trainers[4 * config->skip_gram + 2 * config->hierarchical_softmax + (config->negative > 0)];
+}
 
-            // stop when reaching the end of a chunk
-            if (chunk_id < src_chunks.size() - 1 && src_infile.tellg() >= src_chunks[chunk_id + 1])
-                break;
+template <class Mode>
+void BilingualModel::trainChunk(const MappedFile& src_corpus,
+                                const MappedFile& trg_corpus,
+                                bool pretokenized,
+                                const Chunk& src_chunk,
+                                const Chunk& trg_chunk,
+                                ThreadState& state,
+                                TrainingProgress& progress) {
+    long long last_count = state.word_count;
+    state.alpha = progress.alpha();
+
+    SentenceReader src_reader(src_model, src_corpus, pretokenized, src_chunk.begin, src_chunk.end);
+    SentenceReader trg_reader(trg_model, trg_corpus, pretokenized, trg_chunk.begin, trg_chunk.end);
+
+    // time spent reading vs training (same as MonolingualModel::trainChunk)
+    typedef high_resolution_clock Clock;
+    Clock::time_point read_start = Clock::now();
+
+    while (src_reader.next(state.words) && trg_reader.next(state.trg_words)) {
+        Clock::time_point train_start = Clock::now();
+        state.stats.io_time += duration<double>(train_start - read_start).count();
+
+        state.word_count += trainSentence<Mode>(state.words, state.trg_words, state);
+
+        read_start = Clock::now();
+        state.stats.compute_time += duration<double>(read_start - train_start).count();
+
+        // update learning rate
+        if (state.word_count - last_count > 10000) {
+            last_count = state.word_count;
+            state.alpha = progress.update(state.id, state.word_count);
         }
-
-        words_processed += word_count - last_count;
     }
+
+    progress.update(state.id, state.word_count);
 }
 
-vector<int> BilingualModel::uniformAlignment(const vector<HuffmanNode>& src_nodes,
-                                             const vector<HuffmanNode>& trg_nodes) {
-    vector<int> alignment; // index = position in src_nodes, value = position in trg_nodes (or -1)
+void BilingualModel::uniformAlignment(const vector<int>& src_words, const vector<int>& trg_words,
+                                      vector<int>& alignment) {
+    alignment.clear();
 
-    vector<int> trg_mapping; // maps positions in trg_sent to positions in trg_nodes (or -1)
-    int k = 0;
-    for (auto it = trg_nodes.begin(); it != trg_nodes.end(); ++it) {
-        trg_mapping.push_back(*it == HuffmanNode::UNK ? -1 : k++);
-    }
+    int j = 0;
+    int k = 0; // number of known target words before position j
+    for (int i = 0; i < src_words.size(); ++i) {
+        int trg_pos = i * trg_words.size() / src_words.size();
 
-    for (int i = 0; i < src_nodes.size(); ++i) {
-        int j = i * trg_nodes.size() / src_nodes.size();
+        for (; j < trg_pos; ++j) {
+            if (trg_words[j] != -1) ++k;
+        }
 
-        if (src_nodes[i] != HuffmanNode::UNK) {
-            alignment.push_back(trg_mapping[j]);
+        if (src_words[i] != -1) {
+            alignment.push_back(trg_words[trg_pos] == -1 ? -1 : k);
         }
     }
-
-    return alignment;
 }
 
-int BilingualModel::trainSentence(const string& src_sent, const string& trg_sent) {
-    auto src_nodes = src_model.getNodes(src_sent);  // same size as src_sent, OOV words are replaced by <UNK>
-    auto trg_nodes = trg_model.getNodes(trg_sent);
+template <class Mode>
+int BilingualModel::trainSentence(vector<int>& src_words, vector<int>& trg_words, ThreadState& state) {
+    // `src_words` and `trg_words` have the same size as the sentences, OOV words are replaced by -1
+    vector<int>& alignment = state.alignment;
 
-    // counts the number of words that are in the vocabulary
+    // puts -1 in place of the discarded words, and counts the number of words that are in the vocabulary
     int words = 0;
-    words += src_nodes.size() - count(src_nodes.begin(), src_nodes.end(), HuffmanNode::UNK);
-    words += trg_nodes.size() - count(trg_nodes.begin(), trg_nodes.end(), HuffmanNode::UNK);
+    words += src_model.subsample(src_words, state.rng);
+    words += trg_model.subsample(trg_words, state.rng);
 
-    if (config->subsampling > 0) {
-        src_model.subsample(src_nodes); // puts <UNK> tokens in place of the discarded tokens
-        trg_model.subsample(trg_nodes);
-    }
-
-    if (src_nodes.empty() || trg_nodes.empty()) {
+    if (src_words.empty() || trg_words.empty()) {
         return words;
     }
 
-    // The <UNK> tokens are necessary to perform the alignment (the nodes vector should have the same size
-    // as the original sentence)
-    auto alignment = uniformAlignment(src_nodes, trg_nodes);
+    // The -1 values are necessary to perform the alignment (the vectors should have the same size
+    // as the original sentences)
+    uniformAlignment(src_words, trg_words, alignment);
 
-    // remove <UNK> tokens
-    src_nodes.erase(
-        std::remove(src_nodes.begin(), src_nodes.end(), HuffmanNode::UNK),
-        src_nodes.end());
-    trg_nodes.erase(
-        std::remove(trg_nodes.begin(), trg_nodes.end(), HuffmanNode::UNK),
-        trg_nodes.end());
+    // remove OOV and discarded words
+    src_words.erase(std::remove(src_words.begin(), src_words.end(), -1), src_words.end());
+    trg_words.erase(std::remove(trg_words.begin(), trg_words.end(), -1), trg_words.end());
 
     // Monolingual training
-    for (int src_pos = 0; src_pos < src_nodes.size(); ++src_pos) {
-        trainWord(src_model, src_model, src_nodes, src_nodes, src_pos, src_pos, alpha);
+    for (int src_pos = 0; src_pos < src_words.size(); ++src_pos) {
+        trainWord<Mode>(src_model, src_model, src_words, src_words, src_pos, src_pos, state.alpha, state);
     }
 
-    for (int trg_pos = 0; trg_pos < trg_nodes.size(); ++trg_pos) {
-        trainWord(trg_model, trg_model, trg_nodes, trg_nodes, trg_pos, trg_pos, alpha);
+    for (int trg_pos = 0; trg_pos < trg_words.size(); ++trg_pos) {
+        trainWord<Mode>(trg_model, trg_model, trg_words, trg_words, trg_pos, trg_pos, state.alpha, state);
     }
 
     if (config->beta == 0)
         return words;
 
     // Bilingual training
-    for (int src_pos = 0; src_pos < src_nodes.size(); ++src_pos) {
-        // 1-1 mapping between src_nodes and trg_nodes
+    for (int src_pos = 0; src_pos < src_words.size(); ++src_pos) {
+        // 1-1 mapping between src_words and trg_words
         int trg_pos = alignment[src_pos];
 
         if (trg_pos != -1) { // target word isn't OOV
-            trainWord(src_model, trg_model, src_nodes, trg_nodes, src_pos, trg_pos, alpha * config->beta);
-            trainWord(trg_model, src_model, trg_nodes, src_nodes, trg_pos, src_pos, alpha * config->beta);
+            trainWord<Mode>(src_model, trg_model, src_words, trg_words, src_pos, trg_pos, state.alpha * config->beta, state);
+            trainWord<Mode>(trg_model, src_model, trg_words, src_words, trg_pos, src_pos, state.alpha * config->beta, state);
         }
     }
 
     return words; // returns the number of words processed (for progress estimation)
 }
 
+template <class Mode>
 void BilingualModel::trainWord(MonolingualModel& src_model, MonolingualModel& trg_model,
-                               const vector<HuffmanNode>& src_nodes, const vector<HuffmanNode>& trg_nodes,
-                               int src_pos, int trg_pos, float alpha) {
+                               const vector<int>& src_words, const vector<int>& trg_words,
+                               int src_pos, int trg_pos, float alpha, ThreadState& state) {
 
-    if (config->skip_gram) {
-        return trainWordSkipGram(src_model, trg_model, src_nodes, trg_nodes, src_pos, trg_pos, alpha);
+    if (Mode::skip_gram) {
+        return trainWordSkipGram<Mode>(src_model, trg_model, src_words, trg_words, src_pos, trg_pos, alpha, state);
     } else {
-        return trainWordCBOW(src_model, trg_model, src_nodes, trg_nodes, src_pos, trg_pos, alpha);
+        return trainWordCBOW<Mode>(src_model, trg_model, src_words, trg_words, src_pos, trg_pos, alpha, state);
     }
 }
 
+template <class Mode>
 void BilingualModel::trainWordCBOW(MonolingualModel& src_model, MonolingualModel& trg_model,
-                                   const vector<HuffmanNode>& src_nodes, const vector<HuffmanNode>& trg_nodes,
-                                   int src_pos, int trg_pos, float alpha) {
+                                   const vector<int>& src_words, const vector<int>& trg_words,
+                                   int src_pos, int trg_pos, float alpha, ThreadState& state) {
     // Trains the model by predicting a source node from its aligned context in the target sentence.
     // This function can be used in the reverse direction just by reversing the arguments. Likewise,
     // for monolingual training, use the same values for source and target.
 
     // 'src_pos' is the position in the source sentence of the current node to predict
     // 'trg_pos' is the position of the corresponding node in the target sentence
-    int dimension = config->dimension;
-    vec hidden(dimension, 0);
-    HuffmanNode cur_node = src_nodes[src_pos];
-
-    int this_window_size = 1 + multivec::rand() % config->window_size;
+    const kernels::KernelTable& ops = *state.ops;
+    int d = config->dimension;
+    vec& hidden = state.hidden;
+    vec& error = state.error;
+    hidden.fill(0);
+    int cur_word = src_words[src_pos];
+
+    int this_window_size = 1 + state.rng() % config->window_size;
     int count = 0;
 
     for (int pos = trg_pos - this_window_size; pos <= trg_pos + this_window_size; ++pos) {
-        if (pos < 0 || pos >= trg_nodes.size() || pos == trg_pos) continue;
-        hidden += trg_model.input_weights[trg_nodes[pos].index];
+        if (pos < 0 || pos >= trg_words.size() || pos == trg_pos) continue;
+        ops.axpy(1, trg_model.input_weights[trg_words[pos]].data(), hidden.data(), d);
         ++count;
     }
 
     if (count == 0) return;
-    hidden /= count;
+    ops.scal(1.0f / count, hidden.data(), d);
 
-    vec error(dimension, 0); // compute error & update output weights
-    if (config->hierarchical_softmax) {
-        error += src_model.hierarchicalUpdate(cur_node, hidden, alpha);
+    error.fill(0); // compute error & update output weights
+    if (Mode::hierarchical_softmax) {
+        src_model.hierarchicalUpdate(cur_word, hidden, error, alpha, state);
     }
-    if (config->negative > 0) {
-        error += src_model.negSamplingUpdate(cur_node, hidden, alpha);
+    if (Mode::negative_sampling) {
+        src_model.negSamplingUpdate(cur_word, hidden, error, alpha, state);
     }
 
     // Update input weights
     for (int pos = trg_pos - this_window_size; pos <= trg_pos + this_window_size; ++pos) {
-        if (pos < 0 || pos >= trg_nodes.size() || pos == trg_pos) continue;
-        trg_model.input_weights[trg_nodes[pos].index] += error;
+        if (pos < 0 || pos >= trg_words.size() || pos == trg_pos) continue;
+        ops.axpy(1, error.data(), trg_model.input_weights[trg_words[pos]].data(), d);
     }
 }
 
+template <class Mode>
 void BilingualModel::trainWordSkipGram(MonolingualModel& src_model, MonolingualModel& trg_model,
-                                       const vector<HuffmanNode>& src_nodes, const vector<HuffmanNode>& trg_nodes,
-                                       int src_pos, int trg_pos, float alpha) {
-    HuffmanNode input_word = src_nodes[src_pos];
-
-    int this_window_size = 1 + multivec::rand() % config->window_size;
+                                       const vector<int>& src_words, const vector<int>& trg_words,
+                                       int src_pos, int trg_pos, float alpha, ThreadState& state) {
+    const kernels::KernelTable& ops = *state.ops;
+    int d = config->dimension;
+    vec& error = state.error;
+    int input_word = src_words[src_pos];
+
+    int this_window_size = 1 + state.rng() % config->window_size;
+
+    if (Mode::batch) {
+        // the aligned context predicts the source word (same direction as CBOW), with shared negative samples
+        state.batch_inputs.clear();
+        for (int pos = trg_pos - this_window_size; pos <= trg_pos + this_window_size; ++pos) {
+            if (pos < 0 || pos >= trg_words.size() || pos == trg_pos) continue;
+            state.batch_inputs.push_back(trg_words[pos]);
+        }
+        if (!state.batch_inputs.empty()) {
+            src_model.negSamplingBatchUpdate(input_word, trg_model.input_weights, alpha, state);
+        }
+        if (!Mode::hierarchical_softmax) return;
+    }
 
     for (int pos = trg_pos - this_window_size; pos <= trg_pos + this_window_size; ++pos) {
-        if (pos < 0 || pos >= trg_nodes.size() || pos == trg_pos) continue;
-        HuffmanNode output_word = trg_nodes[pos];
+        if (pos < 0 || pos >= trg_words.size() || pos == trg_pos) continue;
+        int output_word = trg_words[pos];
 
-        vec error(config->dimension, 0);
-        if (config->hierarchical_softmax) {
-            error += trg_model.hierarchicalUpdate(output_word, src_model.input_weights[input_word.index], alpha);
+        error.fill(0);
+        if (Mode::hierarchical_softmax) {
+            trg_model.hierarchicalUpdate(output_word, src_model.input_weights[input_word], error, alpha, state);
         }
-        if (config->negative > 0) {
-            error += trg_model.negSamplingUpdate(output_word, src_model.input_weights[input_word.index], alpha);
+        if (Mode::negative_sampling && !Mode::batch) {
+            trg_model.negSamplingUpdate(output_word, src_model.input_weights[input_word], error, alpha, state);
         }
 
-        src_model.input_weights[input_word.index] += error;
+        ops.axpy(1, error.data(), src_model.input_weights[input_word].data(), d);
     }
 }
 
@@ -268,6 +377,8 @@ void BilingualModel::load(const string& filename) {
     }
 
     ::load(infile, *this);
+    src_model.initWordTables();
+    trg_model.initWordTables();
     src_model.initUnigramTable();
     trg_model.initUnigramTable();
 }
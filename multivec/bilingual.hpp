@@ -12,31 +12,51 @@ private:
     // Configuration of the model (monolingual models have the same configuration)
     BilingualConfig* const config;
 
-    long long words_processed; // number of words processed so far
-    float alpha;
+    TrainingStats stats; // statistics of the last call to train
 
-    void trainChunk(const string& src_file,
-                    const string& trg_file,
-                    const vector<long long>& src_chunks,
-                    const vector<long long>& trg_chunks,
-                    int thread_id);
+    typedef void (BilingualModel::*ChunkTrainer)(const MappedFile&, const MappedFile&, bool, const Chunk&,
+                                                 const Chunk&, ThreadState&, TrainingProgress&);
+    ChunkTrainer chunkTrainer() const; // trainChunk instance for the current configuration (see TrainingMode)
+
+    void trainThread(const MappedFile& src_corpus,
+                     const MappedFile& trg_corpus,
+                     bool pretokenized,
+                     const vector<Chunk>& src_chunks,
+                     const vector<Chunk>& trg_chunks,
+                     int thread_id,
+                     atomic<long long>& next_job,
+                     TrainingProgress& progress,
+                     ChunkTrainer train_chunk);
+
+    template <class Mode>
+    void trainChunk(const MappedFile& src_corpus,
+                    const MappedFile& trg_corpus,
+                    bool pretokenized,
+                    const Chunk& src_chunk,
+                    const Chunk& trg_chunk,
+                    ThreadState& state,
+                    TrainingProgress& progress);
 
     // TODO: unsupervised alignment (GIZA)
-    vector<int> uniformAlignment(const vector<HuffmanNode>& src_nodes, const vector<HuffmanNode>& trg_nodes);
+    void uniformAlignment(const vector<int>& src_words, const vector<int>& trg_words, vector<int>& alignment);
 
-    int trainSentence(const string& trg_sent, const string& src_sent);
+    template <class Mode>
+    int trainSentence(vector<int>& src_words, vector<int>& trg_words, ThreadState& state);
 
+    template <class Mode>
     void trainWord(MonolingualModel& src_params, MonolingualModel& trg_params,
-        const vector<HuffmanNode>& src_nodes, const vector<HuffmanNode>& trg_nodes,
-        int src_pos, int trg_pos, float alpha);
+        const vector<int>& src_words, const vector<int>& trg_words,
+        int src_pos, int trg_pos, float alpha, ThreadState& state);
 
+    template <class Mode>
     void trainWordCBOW(MonolingualModel&, MonolingualModel&,
-        const vector<HuffmanNode>&, const vector<HuffmanNode>&,
-        int, int, float);
+        const vector<int>&, const vector<int>&,
+        int, int, float, ThreadState&);
 
+    template <class Mode>
     void trainWordSkipGram(MonolingualModel&, MonolingualModel&,
-        const vector<HuffmanNode>&, const vector<HuffmanNode>&,
-        int, int, float);
+        const vector<int>&, const vector<int>&,
+        int, int, float, ThreadState&);
 
 public:
     // A bilingual model is comprised of two monolingual models
@@ -49,9 +69,10 @@ public:
     void train(const string& src_file, const string& trg_file, bool initialize = true);
     void load(const string& filename);
     void save(const string& filename) const;
+    const TrainingStats& getStats() const { return stats; }
 
-    float similarity(const string& src_word, const string& trg_word, int policy = 0) const; // cosine similarity
-    float distance(const string& src_word, const string& trg_word, int policy = 0) const; // 1 - cosine similarity
+    float similarity(StringView src_word, StringView trg_word, int policy = 0) const; // cosine similarity
+    float distance(StringView src_word, StringView trg_word, int policy = 0) const; // 1 - cosine similarity
     float similarityNgrams(const string& src_seq, const string& trg_seq, int policy = 0) const; // similarity between two sequences of same size
     float similaritySentence(const string& src_seq, const string& trg_seq, int policy = 0) const; // similarity between two variable-size sequences
     // similarity between two variable-size sequences taking into account part-of-speech tags and inverse document frequencies of terms in the sequences
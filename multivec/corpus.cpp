@@ -0,0 +1,306 @@
+#include "corpus.hpp"
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile(const std::string& filename, bool sequential) : _data(nullptr), _size(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("couldn't open file " + filename);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        throw std::runtime_error("couldn't open file " + filename);
+    }
+
+    _size = static_cast<size_t>(st.st_size);
+    if (_size > 0) { // mmap fails with a length of 0
+        void* addr = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("couldn't map file " + filename);
+        }
+
+        _data = static_cast<const char*>(addr);
+        if (sequential) {
+            madvise(addr, _size, MADV_SEQUENTIAL);
+        }
+    }
+
+    close(fd); // the mapping stays valid after the file is closed
+}
+
+MappedFile::~MappedFile() {
+    if (_data) {
+        munmap(const_cast<char*>(_data), _size);
+    }
+}
+
+bool getFileInfo(const std::string& filename, long long& size, long long& mtime) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) == -1) {
+        return false;
+    }
+
+    size = static_cast<long long>(st.st_size);
+    mtime = static_cast<long long>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    return true;
+}
+
+// lines and words in [begin, end) of a text file
+static void countRange(const char* begin, const char* end, long long& lines, long long& words) {
+    lines = words = 0;
+    bool in_word = false;
+
+    for (const char* p = begin; p != end; ++p) {
+        bool space = is_space(*p);
+        if (*p == '\n') ++lines;
+        if (!space && !in_word) ++words;
+        in_word = !space;
+    }
+    if (begin != end && end[-1] != '\n') ++lines; // last line of the file
+}
+
+// lines and words in [begin, end) of a pre-tokenized file
+static void countRange(const int* begin, const int* end, long long& lines, long long& words) {
+    lines = words = 0;
+
+    for (const int* p = begin; p != end; ++p) {
+        if (*p == END_OF_SENTENCE) ++lines;
+        else ++words;
+    }
+    if (begin != end && end[-1] != END_OF_SENTENCE) ++lines;
+}
+
+// beginning of the line that follows position p
+template<typename T>
+static const T* nextLine(const T* p, const T* end, T delimiter) {
+    p = std::find(p, end, delimiter);
+    return p == end ? end : p + 1;
+}
+
+// boundaries of `n_chunks` ranges of about the same size in [begin, end), moved to the beginning of the next line
+template<typename T>
+static std::vector<const T*> boundaries(const T* begin, const T* end, T delimiter, int n_chunks) {
+    size_t size = end - begin;
+
+    std::vector<const T*> bounds(n_chunks + 1);
+    bounds[0] = begin;
+    bounds[n_chunks] = end;
+    for (int i = 1; i < n_chunks; ++i) {
+        const T* p = begin + size * i / n_chunks;
+        if (p != begin && p[-1] != delimiter) {
+            p = nextLine(p, end, delimiter);
+        }
+        bounds[i] = std::max(p, bounds[i - 1]);
+    }
+
+    return bounds;
+}
+
+// T is char for text files and int for pre-tokenized files (whose data starts after the header)
+template<typename T>
+static std::vector<Chunk> split(const MappedFile& file, size_t offset, T delimiter, int n_chunks, int n_threads) {
+    const T* begin = reinterpret_cast<const T*>(file.data() + offset);
+    const T* end = reinterpret_cast<const T*>(file.data() + file.size());
+    std::vector<const T*> bounds = boundaries(begin, end, delimiter, n_chunks);
+
+    // thread t counts chunks t, t + n_threads, t + 2 * n_threads, etc.
+    std::vector<Chunk> chunks(n_chunks);
+    auto count = [&](int t) {
+        for (int i = t; i < n_chunks; i += n_threads) {
+            countRange(bounds[i], bounds[i + 1], chunks[i].lines, chunks[i].words);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < n_threads; ++t) {
+        threads.push_back(std::thread(count, t));
+    }
+    count(0);
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+
+    long long first_line = 0;
+    for (int i = 0; i < n_chunks; ++i) {
+        chunks[i].begin = reinterpret_cast<const char*>(bounds[i]) - file.data();
+        chunks[i].end = reinterpret_cast<const char*>(bounds[i + 1]) - file.data();
+        chunks[i].first_line = first_line;
+        first_line += chunks[i].lines;
+    }
+
+    return chunks;
+}
+
+template<typename T>
+static std::vector<Chunk> align(const MappedFile& file, T delimiter, const std::vector<Chunk>& ranges,
+                                const std::vector<Chunk>& chunks) {
+    const T* end = reinterpret_cast<const T*>(file.data() + file.size());
+    long long total_lines = ranges.back().first_line + ranges.back().lines;
+    std::vector<Chunk> aligned(chunks.size());
+
+    size_t r = 0;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        long long line = std::min(chunks[i].first_line, total_lines);
+
+        // last range that starts before this line, then skip the lines that precede it in this range
+        while (r + 1 < ranges.size() && ranges[r + 1].first_line <= line) ++r;
+        const T* p = reinterpret_cast<const T*>(file.data() + ranges[r].begin);
+        for (long long k = ranges[r].first_line; k < line; ++k) {
+            p = nextLine(p, end, delimiter);
+        }
+
+        aligned[i].begin = reinterpret_cast<const char*>(p) - file.data();
+        aligned[i].first_line = line;
+        aligned[i].words = 0;
+    }
+
+    for (size_t i = 0; i < aligned.size(); ++i) {
+        bool last = i + 1 == aligned.size();
+        aligned[i].end = last ? file.size() : aligned[i + 1].begin;
+        aligned[i].lines = (last ? total_lines : aligned[i + 1].first_line) - aligned[i].first_line;
+    }
+
+    return aligned;
+}
+
+std::vector<Chunk> splitCorpus(const MappedFile& file, bool pretokenized, int n_chunks, int n_threads) {
+    n_chunks = std::max(n_chunks, 1);
+    n_threads = std::min(std::max(n_threads, 1), n_chunks);
+    if (pretokenized) {
+        return split<int>(file, sizeof(IdsHeader), END_OF_SENTENCE, n_chunks, n_threads);
+    } else {
+        return split<char>(file, 0, '\n', n_chunks, n_threads);
+    }
+}
+
+int trainingBlocks(size_t file_size, int n_threads) {
+    long long max_blocks = static_cast<long long>(std::max(n_threads, 1)) * BLOCKS_PER_THREAD;
+    long long blocks = std::min(max_blocks, static_cast<long long>(file_size / MIN_BLOCK_SIZE));
+    return static_cast<int>(std::max(blocks, 1LL));
+}
+
+std::vector<Chunk> alignCorpus(const MappedFile& file, bool pretokenized, const std::vector<Chunk>& ranges,
+                               const std::vector<Chunk>& chunks) {
+    if (pretokenized) {
+        return align<int>(file, END_OF_SENTENCE, ranges, chunks);
+    } else {
+        return align<char>(file, '\n', ranges, chunks);
+    }
+}
+
+namespace {
+    /**
+     * Word counts with a maximum number of entries (0 for no limit). When the table is full, the words that
+     * appear at most `threshold` times are removed, and the threshold increases (same as ReduceVocab in word2vec).
+     */
+    struct BoundedCounts {
+        WordCounts counts;
+        size_t max_size;
+        int threshold;
+        CountStats stats;
+
+        explicit BoundedCounts(size_t max_size = 0) : max_size(max_size), threshold(0), stats() {}
+
+        void add(const std::string& word, int count = 1) {
+            counts[word] += count;
+            if (max_size > 0 && counts.size() > max_size) {
+                prune();
+            }
+        }
+
+        void prune() {
+            stats.peak_size = std::max(stats.peak_size, counts.size());
+
+            // leave some room, so that the next words don't trigger another pass right away
+            while (counts.size() > max_size * 3 / 4) {
+                ++threshold;
+                for (auto it = counts.begin(); it != counts.end(); ) {
+                    if (it->second <= threshold) {
+                        stats.pruned_words += 1;
+                        stats.pruned_count += it->second;
+                        it = counts.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                stats.max_error += threshold; // a word loses at most `threshold` occurrences in each pass
+            }
+        }
+    };
+}
+
+// counts of the words in [begin, end) of a text file
+static void countWords(const char* begin, const char* end, BoundedCounts& counts) {
+    StringView text(begin, end - begin);
+    StringView token;
+    std::string word;
+
+    while (nextToken(text, token)) {
+        word.assign(token.data(), token.size());
+        counts.add(word);
+    }
+
+    counts.stats.peak_size = std::max(counts.stats.peak_size, counts.counts.size());
+}
+
+WordCounts countWords(const MappedFile& file, int n_threads, size_t max_size, CountStats* stats) {
+    n_threads = std::max(n_threads, 1);
+    std::vector<const char*> bounds = boundaries(file.data(), file.data() + file.size(), '\n', n_threads);
+
+    // the limit is shared by the thread-local tables
+    size_t thread_max_size = max_size == 0 ? 0 : std::max<size_t>(max_size / n_threads, 1);
+    std::vector<BoundedCounts> counts(n_threads, BoundedCounts(thread_max_size));
+
+    auto count = [&](int i) { countWords(bounds[i], bounds[i + 1], counts[i]); };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < n_threads; ++i) {
+        threads.push_back(std::thread(count, i));
+    }
+    count(0);
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+
+    CountStats total_stats = {};
+    size_t remaining_size = 0; // entries in the tables that aren't merged yet
+    for (auto it = counts.begin(); it != counts.end(); ++it) {
+        total_stats.peak_size += it->stats.peak_size; // the threads may all reach their peak at the same time
+        total_stats.pruned_words += it->stats.pruned_words;
+        total_stats.pruned_count += it->stats.pruned_count;
+        total_stats.max_error += it->stats.max_error;
+        remaining_size += it->counts.size();
+    }
+
+    // merge into the largest table
+    auto largest = std::max_element(counts.begin(), counts.end(),
+        [](const BoundedCounts& a, const BoundedCounts& b) { return a.counts.size() < b.counts.size(); });
+    BoundedCounts total(max_size);
+    total.counts.swap(largest->counts);
+    remaining_size -= total.counts.size();
+
+    for (auto it = counts.begin(); it != counts.end(); ++it) {
+        for (auto word = it->counts.begin(); word != it->counts.end(); ++word) {
+            total.add(word->first, word->second);
+        }
+        total_stats.peak_size = std::max(total_stats.peak_size, total.counts.size() + remaining_size);
+        remaining_size -= it->counts.size();
+        WordCounts().swap(it->counts); // free memory as soon as possible
+    }
+
+    total_stats.pruned_words += total.stats.pruned_words;
+    total_stats.pruned_count += total.stats.pruned_count;
+    total_stats.max_error += total.stats.max_error;
+
+    if (stats) {
+        *stats = total_stats;
+    }
+    return total.counts;
+}
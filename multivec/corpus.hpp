@@ -0,0 +1,244 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * @brief Non-owning reference to a sequence of characters (like C++17's std::string_view).
+ * The referenced memory must outlive the view.
+ */
+class StringView {
+    const char* _data;
+    size_t _size;
+
+public:
+    StringView() : _data(nullptr), _size(0) {}
+    StringView(const char* data, size_t size) : _data(data), _size(size) {}
+    StringView(const std::string& s) : _data(s.data()), _size(s.size()) {}
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    const char* begin() const { return _data; }
+    const char* end() const { return _data + _size; }
+    char operator[](size_t i) const { return _data[i]; }
+
+    std::string str() const { return std::string(_data, _size); }
+
+    bool operator==(const StringView& other) const {
+        return _size == other._size && (_size == 0 || memcmp(_data, other._data, _size) == 0);
+    }
+    bool operator!=(const StringView& other) const { return !(*this == other); }
+};
+
+// same delimiters as `istream >> string` in the "C" locale
+inline bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * @brief Read the next whitespace-separated token of `text` into `token`, and move `text` past it.
+ * Return false when there are no tokens left.
+ */
+inline bool nextToken(StringView& text, StringView& token) {
+    const char* p = text.begin();
+    const char* end = text.end();
+
+    while (p != end && is_space(*p)) ++p;
+    const char* start = p;
+    while (p != end && !is_space(*p)) ++p;
+
+    token = StringView(start, p - start);
+    text = StringView(p, end - p);
+    return p != start;
+}
+
+/**
+ * @brief Split `text` into whitespace-separated tokens (see nextToken). The tokens point into `text`, which
+ * must outlive them. This is the tokenizer used everywhere (training, queries, compute-accuracy).
+ */
+inline void tokenize(StringView text, std::vector<StringView>& tokens) {
+    tokens.clear();
+    StringView token;
+    while (nextToken(text, token)) {
+        tokens.push_back(token);
+    }
+}
+
+inline std::vector<StringView> tokenize(StringView text) {
+    std::vector<StringView> tokens;
+    tokenize(text, tokens);
+    return tokens;
+}
+
+/**
+ * @brief Read-only memory mapping of a whole file. The training threads share the same mapping,
+ * and read their lines directly from the page cache, without any copy or iostream parsing.
+ * By default, the kernel is told that the file will be read sequentially (madvise), so that
+ * it reads ahead more aggressively.
+ */
+class MappedFile {
+    const char* _data;
+    size_t _size;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    explicit MappedFile(const std::string& filename, bool sequential = true); // throws if the file can't be opened
+    ~MappedFile();
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+};
+
+/**
+ * @brief Iterate over the lines of a mapped file that start in the byte range [begin, end).
+ * Lines are returned without their end-of-line character.
+ */
+class LineReader {
+    const char* pos;
+    const char* start;
+    const char* limit;
+    const char* file_end;
+
+public:
+    LineReader(const MappedFile& file, size_t begin = 0, size_t end = static_cast<size_t>(-1)) :
+            pos(file.data() + std::min(begin, file.size())),
+            start(file.data()),
+            limit(file.data() + std::min(end, file.size())),
+            file_end(file.data() + file.size())
+    {}
+
+    bool next(StringView& line) {
+        if (pos >= limit) {
+            return false;
+        }
+
+        const char* eol = static_cast<const char*>(memchr(pos, '\n', file_end - pos));
+        if (!eol) eol = file_end;
+
+        line = StringView(pos, eol - pos);
+        pos = eol == file_end ? eol : eol + 1;
+        return true;
+    }
+
+    size_t position() const { return pos - start; } // offset of the next line in the file
+};
+
+const int END_OF_SENTENCE = -2; // sentence delimiter in pre-tokenized corpora (-1 is for OOV words)
+const char IDS_MAGIC[8] = "MVIDS01";
+
+/**
+ * @brief Header of a pre-tokenized corpus (see --train-ids). The header is followed by the word indices
+ * of each sentence (int32, -1 for OOV words), each sentence being terminated by END_OF_SENTENCE.
+ * The file is stale (and converted again) if the text file or the vocabulary have changed.
+ */
+struct IdsHeader {
+    char magic[8];
+    unsigned long long vocab_hash; // see MonolingualModel::vocabHash
+    long long source_size; // size of the text file in bytes
+    long long source_mtime; // last modification time of the text file, in nanoseconds
+    long long lines;
+    long long words; // total number of words, including OOV words
+};
+
+/**
+ * @brief Get the size and last modification time (in nanoseconds) of a file. Return false if it doesn't exist.
+ */
+bool getFileInfo(const std::string& filename, long long& size, long long& mtime);
+
+/**
+ * @brief Iterate over the sentences of a pre-tokenized corpus that start in the byte range [begin, end).
+ */
+class IdReader {
+    const int* pos;
+    const int* limit;
+    const int* file_end;
+
+public:
+    IdReader(const MappedFile& file, size_t begin = sizeof(IdsHeader), size_t end = static_cast<size_t>(-1)) :
+            pos(reinterpret_cast<const int*>(file.data() + std::min(begin, file.size()))),
+            limit(reinterpret_cast<const int*>(file.data() + std::min(end, file.size()))),
+            file_end(reinterpret_cast<const int*>(file.data() + file.size()))
+    {}
+
+    bool next(std::vector<int>& words) {
+        if (pos >= limit) {
+            return false;
+        }
+
+        words.clear();
+        while (pos != file_end && *pos != END_OF_SENTENCE) {
+            words.push_back(*pos++);
+        }
+        if (pos != file_end) ++pos;
+        return true;
+    }
+};
+
+/**
+ * @brief Part of a corpus, which is read by one training thread: byte range [begin, end), which starts
+ * at the beginning of line `first_line`.
+ */
+struct Chunk {
+    size_t begin;
+    size_t end;
+    long long first_line;
+    long long lines;
+    long long words; // only counted by splitCorpus
+};
+
+/**
+ * @brief Split a corpus into `n_chunks` byte ranges of about the same size, whose boundaries are moved
+ * to the beginning of the next line (or sentence, for pre-tokenized corpora). The lines and words of each
+ * chunk are counted in parallel (by `n_threads` threads), and merged to find the first line of each chunk.
+ */
+std::vector<Chunk> splitCorpus(const MappedFile& file, bool pretokenized, int n_chunks, int n_threads);
+
+const int BLOCKS_PER_THREAD = 16;
+const size_t MIN_BLOCK_SIZE = 1 << 16; // in bytes
+
+/**
+ * @brief Number of blocks a training corpus is split into: several blocks per thread, so that threads that
+ * are done with their block can claim another one (see MonolingualModel::trainThread), while the blocks
+ * remain large enough to make the cost of claiming them negligible.
+ */
+int trainingBlocks(size_t file_size, int n_threads);
+
+/**
+ * @brief Split a corpus into chunks that start at the same line numbers as `chunks` (e.g., to align the
+ * target side of a parallel corpus with the source side). `ranges` is the result of splitCorpus on this file,
+ * which is used to skip directly to the right part of the file.
+ */
+std::vector<Chunk> alignCorpus(const MappedFile& file, bool pretokenized, const std::vector<Chunk>& ranges,
+                               const std::vector<Chunk>& chunks);
+
+typedef std::unordered_map<std::string, int> WordCounts;
+
+// approximate size in memory of an entry of WordCounts (hash table node, cached hash value and bucket),
+// not counting the characters of words that are too long for the small string optimization
+const size_t WORD_COUNTS_ENTRY_SIZE = sizeof(WordCounts::value_type) + 3 * sizeof(void*);
+
+/**
+ * @brief Statistics of countWords: peak number of entries in the count tables, and words that were
+ * removed because of the size limit.
+ */
+struct CountStats {
+    size_t peak_size;
+    size_t pruned_words; // number of pruned entries (a word may be pruned several times)
+    long long pruned_count; // number of occurrences that were lost
+    long long max_error; // maximum underestimation of the count of a word
+};
+
+/**
+ * @brief Count the words of a text file. The file is split into `n_threads` byte ranges (at line boundaries),
+ * which are counted in parallel into thread-local tables, and then merged.
+ * With a `max_size` greater than 0, the tables together never hold more than about `max_size` words:
+ * rare words are pruned with an increasing threshold, and their counts are lost.
+ */
+WordCounts countWords(const MappedFile& file, int n_threads, size_t max_size = 0, CountStats* stats = nullptr);
@@ -7,22 +7,22 @@
  * For the score to be in [0,1], the weights need to be normalized beforehand.
  * Return 0 if word1 or word2 is unknown.
  */
-float MonolingualModel::similarity(const string& word1, const string& word2, int policy) const {
-    auto it1 = vocabulary.find(word1);
-    auto it2 = vocabulary.find(word2);
+float MonolingualModel::similarity(StringView word1, StringView word2, int policy) const {
+    int index1 = vocabulary.find(word1);
+    int index2 = vocabulary.find(word2);
 
-    if (it1 == vocabulary.end() || it2 == vocabulary.end()) {
+    if (index1 == -1 || index2 == -1) {
         return 0.0;
-    } else if (it1->second.index == it2->second.index) {
+    } else if (index1 == index2) {
         return 1.0;
     } else {
-        vec v1 = wordVec(it1->second.index, policy);
-        vec v2 = wordVec(it2->second.index, policy);
+        vec v1 = wordVec(index1, policy);
+        vec v2 = wordVec(index2, policy);
         return cosineSimilarity(v1, v2);
     }
 }
 
-float MonolingualModel::distance(const string& word1, const string& word2, int policy) const {
+float MonolingualModel::distance(StringView word1, StringView word2, int policy) const {
     return 1 - similarity(word1, word2, policy);
 }
 
@@ -32,42 +32,83 @@ static bool comp(const pair<string, float>& p1, const pair<string, float>& p2) {
 }
 
 /**
- * @brief Return an ordered list of the `n` closest words to `word` according to cosine similarity.
+ * @brief Cosine similarity between `v` and the embeddings (see wordVec) of all the words in the vocabulary.
+ * The dot products are matrix-vector products with the weight matrices (see kernels::gemv), so that the
+ * embeddings aren't copied.
  */
-vector<pair<string, float>> MonolingualModel::closest(const string& word, int n, int policy) const {
-    vector<pair<string, float>> res;
-    auto it = vocabulary.find(word);
+vector<float> MonolingualModel::similarities(const vec& v, int policy) const {
+    size_t n_words = vocabulary.size(), d = config->dimension;
+    vector<float> res(n_words), norms(n_words);
+    const kernels::KernelTable& ops = kernels::get(d);
 
-    if (it == vocabulary.end()) {
-        throw runtime_error("OOV word");
+    bool concat = policy == 1 && config->negative > 0;
+    bool sum = policy == 2 && config->negative > 0;
+    const mat& weights = policy == 3 && config->negative > 0 ? output_weights : input_weights;
+
+    if (v.size() != wordVecSize(policy)) {
+        throw runtime_error("wrong vector size");
     }
 
-    int index = it->second.index;
-    vec v1 = wordVec(index, policy);
+    // dot products: W v, or W_in v_1 + W_out v_2 for the concatenation, or (W_in + W_out) v for the sum
+    kernels::gemv(n_words, d, 1, weights.data(), weights.stride(), v.data(), 0, res.data());
+    if (concat || sum) {
+        const float* v2 = concat ? v.data() + d : v.data();
+        kernels::gemv(n_words, d, 1, output_weights.data(), output_weights.stride(), v2, 1, res.data());
+    }
 
-    for (auto it = vocabulary.begin(); it != vocabulary.end(); ++it) {
-        if (it->second.index != index) {
-            vec v2 = wordVec(it->second.index, policy);
-            res.push_back({it->second.word, cosineSimilarity(v1, v2)});
+    for (size_t i = 0; i < n_words; ++i) {
+        const float* w = weights[i].data();
+        norms[i] = ops.dot(w, w, d);
+        if (concat || sum) {
+            const float* w2 = output_weights[i].data();
+            norms[i] += ops.dot(w2, w2, d) + (sum ? 2 * ops.dot(w, w2, d) : 0);
         }
     }
 
-    std::partial_sort(res.begin(), res.begin() + n, res.end(), comp);
-    if (res.size() > n) res.resize(n);
+    float norm = v.norm();
+    for (size_t i = 0; i < n_words; ++i) {
+        res[i] /= norm * std::sqrt(norms[i]);
+    }
     return res;
 }
 
-vector<pair<string, float>> MonolingualModel::closest(const vec& v, int n, int policy) const {
+/**
+ * @brief Return an ordered list of the `n` closest words to `v` according to cosine similarity,
+ * excluding the word of index `skip` (-1 for none). Only the `n` best words are copied into strings.
+ */
+vector<pair<string, float>> MonolingualModel::closest(const vec& v, int n, int policy, int skip) const {
+    vector<float> scores = similarities(v, policy);
+    vector<pair<float, int>> candidates;
+    candidates.reserve(scores.size());
+    for (int i = 0; i < scores.size(); ++i) {
+        if (i != skip) candidates.push_back({-scores[i], i}); // best scores first
+    }
+
+    n = min<int>(max(n, 0), candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end());
+
     vector<pair<string, float>> res;
+    for (int i = 0; i < n; ++i) {
+        res.push_back({vocabulary.word(candidates[i].second).str(), -candidates[i].first});
+    }
+    return res;
+}
 
-    for (auto it = vocabulary.begin(); it != vocabulary.end(); ++it) {
-        vec v2 = wordVec(it->second.index, policy);
-        res.push_back({it->second.word, cosineSimilarity(v, v2)});
+/**
+ * @brief Return an ordered list of the `n` closest words to `word` according to cosine similarity.
+ */
+vector<pair<string, float>> MonolingualModel::closest(const string& word, int n, int policy) const {
+    int index = vocabulary.find(word);
+
+    if (index == -1) {
+        throw runtime_error("OOV word");
     }
 
-    std::partial_sort(res.begin(), res.begin() + n, res.end(), comp);
-    if (res.size() > n) res.resize(n);
-    return res;
+    return closest(wordVec(index, policy), n, policy, index);
+}
+
+vector<pair<string, float>> MonolingualModel::closest(const vec& v, int n, int policy) const {
+    return closest(v, n, policy, -1);
 }
 
 /**
@@ -75,20 +116,19 @@ vector<pair<string, float>> MonolingualModel::closest(const vec& v, int n, int p
  */
 vector<pair<string, float>> MonolingualModel::closest(const string& word, const vector<string>& words, int policy) const {
     vector<pair<string, float>> res;
-    auto it = vocabulary.find(word);
+    int index = vocabulary.find(word);
 
-    if (it == vocabulary.end()) {
+    if (index == -1) {
         throw runtime_error("OOV word");
     }
 
-    int index = it->second.index;
     vec v1 = wordVec(index, policy);
 
     for (auto it = words.begin(); it != words.end(); ++it) {
-        auto node_it = vocabulary.find(*it);
-        if (node_it != vocabulary.end()) {
-            vec v2 = wordVec(node_it->second.index, policy);
-            res.push_back({node_it->second.word, cosineSimilarity(v1, v2)});
+        int i = vocabulary.find(*it);
+        if (i != -1) {
+            vec v2 = wordVec(i, policy);
+            res.push_back({*it, cosineSimilarity(v1, v2)});
         }
     }
 
@@ -97,8 +137,8 @@ vector<pair<string, float>> MonolingualModel::closest(const string& word, const
 }
 
 float MonolingualModel::similarityNgrams(const string& seq1, const string& seq2, int policy) const {
-    auto words1 = split(seq1);
-    auto words2 = split(seq2);
+    auto words1 = tokenize(seq1);
+    auto words2 = tokenize(seq2);
 
     if (words2.size() != words2.size()) {
         throw runtime_error("input sequences don't have the same size");
@@ -154,11 +194,11 @@ void MonolingualModel::normalizeWeights() {
 }
 
 float MonolingualModel::similaritySentence(const string& seq1, const string& seq2, int policy) const {
-    auto words1 = split(seq1);
-    auto words2 = split(seq2);
+    auto words1 = tokenize(seq1);
+    auto words2 = tokenize(seq2);
     
-    vec vec1(config->dimension);
-    vec vec2(config->dimension);
+    vec vec1(wordVecSize(policy));
+    vec vec2(wordVecSize(policy));
     
     for (auto it = words1.begin(); it != words1.end(); ++it) {
         try {
@@ -232,24 +272,24 @@ const static std::map<std::string, float> syntax_weights = {
 */
 float MonolingualModel::similaritySentenceSyntax(const string& seq1, const string& seq2, const string& tags1, const string& tags2,
                                                  const vector<float>& idf1, const vector<float>& idf2, float alpha, int policy) const {
-    auto words1 = split(seq1);
-    auto words2 = split(seq2);
-    auto pos_tags1 = split(tags1);
-    auto pos_tags2 = split(tags2);
+    auto words1 = tokenize(seq1);
+    auto words2 = tokenize(seq2);
+    auto pos_tags1 = tokenize(tags1);
+    auto pos_tags2 = tokenize(tags2);
     
-    vec vec1(config->dimension);
-    vec vec2(config->dimension);
+    vec vec1(wordVecSize(policy));
+    vec vec2(wordVecSize(policy));
     
     for (size_t i = 0; i < words1.size() && i < pos_tags1.size() && i < idf1.size(); ++i) {
         try {
-            vec1 += wordVec(words1[i], policy) * pow(syntax_weights.at(pos_tags1[i]), 1 - alpha) * pow(idf1[i], alpha);
+            vec1 += wordVec(words1[i], policy) * pow(syntax_weights.at(pos_tags1[i].str()), 1 - alpha) * pow(idf1[i], alpha);
         }
         catch (runtime_error) {}
     }
     
     for (size_t i = 0; i < words2.size() && i < pos_tags2.size() && i < idf2.size(); ++i) {
         try {
-            vec2 += wordVec(words2[i], policy) * pow(syntax_weights.at(pos_tags2[i]), 1 - alpha) * pow(idf2[i], alpha);
+            vec2 += wordVec(words2[i], policy) * pow(syntax_weights.at(pos_tags2[i].str()), 1 - alpha) * pow(idf2[i], alpha);
         }
         catch (runtime_error) {}
     }
@@ -264,8 +304,8 @@ float MonolingualModel::similaritySentenceSyntax(const string& seq1, const strin
 }
 
 float MonolingualModel::softWER(const string& hyp, const string& ref, int policy) const {
-    auto s1 = split(hyp);
-    auto s2 = split(ref);
+    auto s1 = tokenize(hyp);
+    auto s2 = tokenize(ref);
 	const size_t len1 = s1.size(), len2 = s2.size();
 	vector<vector<float>> d(len1 + 1, vector<float>(len2 + 1));
 
@@ -303,54 +343,54 @@ float MonolingualModel::softWER(const string& hyp, const string& ref, int policy
  * For the score to be in [0,1], the weights need to be normalized beforehand.
  * Return 0 if word1 or word2 is unknown.
  */
-float BilingualModel::similarity(const string& src_word, const string& trg_word, int policy) const {
-    auto it1 = src_model.vocabulary.find(src_word);
-    auto it2 = trg_model.vocabulary.find(trg_word);
+float BilingualModel::similarity(StringView src_word, StringView trg_word, int policy) const {
+    int index1 = src_model.vocabulary.find(src_word);
+    int index2 = trg_model.vocabulary.find(trg_word);
 
-    if (it1 == src_model.vocabulary.end() || it2 == trg_model.vocabulary.end()) {
+    if (index1 == -1 || index2 == -1) {
         return 0.0;
     } else {
-        vec v1 = src_model.wordVec(it1->second.index, policy);
-        vec v2 = trg_model.wordVec(it2->second.index, policy);
+        vec v1 = src_model.wordVec(index1, policy);
+        vec v2 = trg_model.wordVec(index2, policy);
         return cosineSimilarity(v1, v2);
     }
 }
 
 
-float BilingualModel::distance(const string& src_word, const string& trg_word, int policy) const {
+float BilingualModel::distance(StringView src_word, StringView trg_word, int policy) const {
     return 1 - similarity(src_word, trg_word, policy);
 }
 
 
 vector<pair<string, float>> BilingualModel::trg_closest(const string& src_word, int n, int policy) const {
     vector<pair<string, float>> res;
-    auto it = src_model.vocabulary.find(src_word);
+    int index = src_model.vocabulary.find(src_word);
 
-    if (it == src_model.vocabulary.end()) {
+    if (index == -1) {
         throw runtime_error("OOV word");
     }
 
-    vec v = src_model.wordVec(it->second.index, policy);
+    vec v = src_model.wordVec(index, policy);
     return trg_model.closest(v, n, policy);
 }
 
 
 vector<pair<string, float>> BilingualModel::src_closest(const string& trg_word, int n, int policy) const {
     vector<pair<string, float>> res;
-    auto it = trg_model.vocabulary.find(trg_word);
+    int index = trg_model.vocabulary.find(trg_word);
 
-    if (it == trg_model.vocabulary.end()) {
+    if (index == -1) {
         throw runtime_error("OOV word");
     }
 
-    vec v = trg_model.wordVec(it->second.index, policy);
+    vec v = trg_model.wordVec(index, policy);
     return src_model.closest(v, n, policy);
 }
 
 
 float BilingualModel::similarityNgrams(const string& src_seq, const string& trg_seq, int policy) const {
-    auto src_words = split(src_seq);
-    auto trg_words = split(trg_seq);
+    auto src_words = tokenize(src_seq);
+    auto trg_words = tokenize(trg_seq);
 
     if (trg_words.size() != trg_words.size()) {
         throw runtime_error("input sequences don't have the same size");
@@ -374,11 +414,11 @@ float BilingualModel::similarityNgrams(const string& src_seq, const string& trg_
 }
 
 float BilingualModel::similaritySentence(const string& src_seq, const string& trg_seq, int policy) const {
-    auto src_words = split(src_seq);
-    auto trg_words = split(trg_seq);
+    auto src_words = tokenize(src_seq);
+    auto trg_words = tokenize(trg_seq);
     
-    vec src_vec(config->dimension);
-    vec trg_vec(config->dimension);
+    vec src_vec(src_model.wordVecSize(policy));
+    vec trg_vec(trg_model.wordVecSize(policy));
     
     for (auto it = src_words.begin(); it != src_words.end(); ++it) {
         try {
@@ -417,23 +457,23 @@ float BilingualModel::similaritySentence(const string& src_seq, const string& tr
 */
 float BilingualModel::similaritySentenceSyntax(const string& src_seq, const string& trg_seq, const string& src_tags, const string& trg_tags,
                                                const vector<float>& src_idf, const vector<float>& trg_idf, float alpha, int policy) const {    
-    auto src_words = split(src_seq);
-    auto trg_words = split(trg_seq);
-    auto src_pos_tags = split(src_tags);
-    auto trg_pos_tags = split(trg_tags);
+    auto src_words = tokenize(src_seq);
+    auto trg_words = tokenize(trg_seq);
+    auto src_pos_tags = tokenize(src_tags);
+    auto trg_pos_tags = tokenize(trg_tags);
     
-    vec src_vec(config->dimension);
-    vec trg_vec(config->dimension);
+    vec src_vec(src_model.wordVecSize(policy));
+    vec trg_vec(trg_model.wordVecSize(policy));
     
     for (size_t i = 0; i < src_words.size() && i < src_pos_tags.size() && i < src_idf.size(); ++i) {
         try {
-            src_vec += src_model.wordVec(src_words[i], policy) * pow(syntax_weights.at(src_pos_tags[i]), 1 - alpha) * pow(src_idf[i], alpha);
+            src_vec += src_model.wordVec(src_words[i], policy) * pow(syntax_weights.at(src_pos_tags[i].str()), 1 - alpha) * pow(src_idf[i], alpha);
         }
         catch (runtime_error) {}
     }
     for (size_t i = 0; i < trg_words.size() && i < trg_pos_tags.size() && i < trg_idf.size(); ++i) {
         try {
-            trg_vec += trg_model.wordVec(trg_words[i], policy) * pow(syntax_weights.at(trg_pos_tags[i]), 1 - alpha) * pow(trg_idf[i], alpha);
+            trg_vec += trg_model.wordVec(trg_words[i], policy) * pow(syntax_weights.at(trg_pos_tags[i].str()), 1 - alpha) * pow(trg_idf[i], alpha);
         }
         catch (runtime_error) {}
     }
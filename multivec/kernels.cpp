@@ -0,0 +1,387 @@
+#include "kernels.hpp"
+#include <algorithm>
+#ifdef MULTIVEC_BLAS
+#include <cblas.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MULTIVEC_X86
+#include <immintrin.h>
+#endif
+
+namespace kernels {
+
+/*
+ * Each implementation is a template on the size of the vectors (0 for any size), and is instantiated
+ * for the generic case, and for the common embedding sizes (see get).
+ */
+#define KERNELS(isa, n) {#isa, n, dot_##isa<n>, axpy_##isa<n>, scal_##isa<n>}
+#define KERNEL_TABLES(isa) {KERNELS(isa, 0), KERNELS(isa, 50), KERNELS(isa, 100), KERNELS(isa, 128), \
+                            KERNELS(isa, 200), KERNELS(isa, 300)}
+static const size_t N_TABLES = 6;
+
+template <size_t N>
+static float dot_scalar(const float* x, const float* y, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    float res = 0;
+    for (size_t i = 0; i < len; ++i) {
+        res += x[i] * y[i];
+    }
+    return res;
+}
+
+template <size_t N>
+static void axpy_scalar(float alpha, const float* x, float* y, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    for (size_t i = 0; i < len; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
+
+template <size_t N>
+static void scal_scalar(float alpha, float* x, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    for (size_t i = 0; i < len; ++i) {
+        x[i] *= alpha;
+    }
+}
+
+static const KernelTable scalar_kernels[N_TABLES] = KERNEL_TABLES(scalar);
+
+#ifdef MULTIVEC_X86
+
+/*
+ * SSE
+ */
+template <size_t N>
+__attribute__((target("sse2")))
+static float dot_sse(const float* x, const float* y, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(y + i + 4)));
+    }
+    for (; i + 4 <= len; i += 4) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+    }
+
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    float res = _mm_cvtss_f32(acc0);
+
+    if (N == 0 || N % 4 != 0) { // constant sizes that are a multiple of 4 have no tail
+        for (; i < len; ++i) {
+            res += x[i] * y[i];
+        }
+    }
+    return res;
+}
+
+template <size_t N>
+__attribute__((target("sse2")))
+static void axpy_sse(float alpha, const float* x, float* y, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    __m128 a = _mm_set1_ps(alpha);
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4) {
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(a, _mm_loadu_ps(x + i))));
+    }
+    if (N == 0 || N % 4 != 0) { // constant sizes that are a multiple of 4 have no tail
+        for (; i < len; ++i) {
+            y[i] += alpha * x[i];
+        }
+    }
+}
+
+template <size_t N>
+__attribute__((target("sse2")))
+static void scal_sse(float alpha, float* x, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    __m128 a = _mm_set1_ps(alpha);
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4) {
+        _mm_storeu_ps(x + i, _mm_mul_ps(a, _mm_loadu_ps(x + i)));
+    }
+    if (N == 0 || N % 4 != 0) { // constant sizes that are a multiple of 4 have no tail
+        for (; i < len; ++i) {
+            x[i] *= alpha;
+        }
+    }
+}
+
+static const KernelTable sse_kernels[N_TABLES] = KERNEL_TABLES(sse);
+
+/*
+ * AVX2 + FMA
+ */
+template <size_t N>
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float* x, const float* y, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+    }
+    for (; i + 8 <= len; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+    }
+
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 acc = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    float res = _mm_cvtss_f32(acc);
+
+    if (N == 0 || N % 8 != 0) { // constant sizes that are a multiple of 8 have no tail
+        for (; i < len; ++i) {
+            res += x[i] * y[i];
+        }
+    }
+    return res;
+}
+
+template <size_t N>
+__attribute__((target("avx2,fma")))
+static void axpy_avx2(float alpha, const float* x, float* y, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    __m256 a = _mm256_set1_ps(alpha);
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+    if (N == 0 || N % 8 != 0) { // constant sizes that are a multiple of 8 have no tail
+        for (; i < len; ++i) {
+            y[i] += alpha * x[i];
+        }
+    }
+}
+
+template <size_t N>
+__attribute__((target("avx2,fma")))
+static void scal_avx2(float alpha, float* x, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    __m256 a = _mm256_set1_ps(alpha);
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        _mm256_storeu_ps(x + i, _mm256_mul_ps(a, _mm256_loadu_ps(x + i)));
+    }
+    if (N == 0 || N % 8 != 0) { // constant sizes that are a multiple of 8 have no tail
+        for (; i < len; ++i) {
+            x[i] *= alpha;
+        }
+    }
+}
+
+static const KernelTable avx2_kernels[N_TABLES] = KERNEL_TABLES(avx2);
+
+/*
+ * AVX-512 (the tail of each loop is handled with a masked load/store)
+ */
+template <size_t N>
+__attribute__((target("avx512f")))
+static float dot_avx512(const float* x, const float* y, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), acc1);
+    }
+    for (; i + 16 <= len; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+    }
+    if (i < len) {
+        __mmask16 mask = static_cast<__mmask16>((1u << (len - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i), acc1);
+    }
+
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+template <size_t N>
+__attribute__((target("avx512f")))
+static void axpy_avx512(float alpha, const float* x, float* y, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    __m512 a = _mm512_set1_ps(alpha);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(a, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+    }
+    if (i < len) {
+        __mmask16 mask = static_cast<__mmask16>((1u << (len - i)) - 1);
+        __m512 res = _mm512_fmadd_ps(a, _mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i));
+        _mm512_mask_storeu_ps(y + i, mask, res);
+    }
+}
+
+template <size_t N>
+__attribute__((target("avx512f")))
+static void scal_avx512(float alpha, float* x, size_t n) {
+    const size_t len = N ? N : n; // constant size: the loops are unrolled, and the tails removed
+    __m512 a = _mm512_set1_ps(alpha);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        _mm512_storeu_ps(x + i, _mm512_mul_ps(a, _mm512_loadu_ps(x + i)));
+    }
+    if (i < len) {
+        __mmask16 mask = static_cast<__mmask16>((1u << (len - i)) - 1);
+        _mm512_mask_storeu_ps(x + i, mask, _mm512_mul_ps(a, _mm512_maskz_loadu_ps(mask, x + i)));
+    }
+}
+
+static const KernelTable avx512_kernels[N_TABLES] = KERNEL_TABLES(avx512);
+
+#endif
+
+#undef KERNELS
+#undef KERNEL_TABLES
+
+/**
+ * @brief Return the kernels with the given name (generic version first, then specialized versions), or nullptr if they are unknown or not supported by this CPU.
+ */
+static const KernelTable* findKernels(const std::string& name) {
+#ifdef MULTIVEC_X86
+    __builtin_cpu_init();
+
+    if (name == "avx512" && __builtin_cpu_supports("avx512f"))
+        return avx512_kernels;
+    if (name == "avx2" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return avx2_kernels;
+    if (name == "sse" && __builtin_cpu_supports("sse2"))
+        return sse_kernels;
+#endif
+    if (name == "scalar")
+        return scalar_kernels;
+    return nullptr;
+}
+
+static const KernelTable* bestKernels() {
+    const char* names[] = {"avx512", "avx2", "sse"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        const KernelTable* table = findKernels(names[i]);
+        if (table) return table;
+    }
+    return scalar_kernels;
+}
+
+// Kernels that are called before static initialization is over (if any) use the scalar implementation.
+static const KernelTable* current = scalar_kernels;
+static const bool initialized = (current = bestKernels()) != nullptr;
+
+float dot(const float* x, const float* y, size_t n) {
+    return current->dot(x, y, n);
+}
+
+void axpy(float alpha, const float* x, float* y, size_t n) {
+    current->axpy(alpha, x, y, n);
+}
+
+void scal(float alpha, float* x, size_t n) {
+    current->scal(alpha, x, n);
+}
+
+const KernelTable& get(size_t n) {
+    for (size_t i = 1; i < N_TABLES; ++i) {
+        if (current[i].size == n) return current[i];
+    }
+    return current[0];
+}
+
+std::string name() {
+    return current->name;
+}
+
+bool select(const std::string& name) {
+    const KernelTable* table = findKernels(name);
+    if (table) current = table;
+    return table != nullptr;
+}
+
+#ifdef MULTIVEC_BLAS
+
+void gemv(size_t m, size_t n, float alpha, const float* a, size_t lda, const float* x, float beta, float* y) {
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, m, n, alpha, a, lda, x, 1, beta, y, 1);
+}
+
+void gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda,
+          const float* b, size_t ldb, float beta, float* c, size_t ldc) {
+    cblas_sgemm(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans, trans_b ? CblasTrans : CblasNoTrans,
+                m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+bool blas() {
+    return true;
+}
+
+#else
+
+// y = beta * y (like in BLAS, y is only written to when beta is 0, so that it may contain NaNs)
+static void scaleOutput(const KernelTable& ops, float beta, float* y, size_t n) {
+    if (beta == 0) {
+        std::fill(y, y + n, 0.0f);
+    } else if (beta != 1) {
+        ops.scal(beta, y, n);
+    }
+}
+
+void gemv(size_t m, size_t n, float alpha, const float* a, size_t lda, const float* x, float beta, float* y) {
+    const KernelTable& ops = get(n);
+    for (size_t i = 0; i < m; ++i) {
+        float res = alpha * ops.dot(a + i * lda, x, n);
+        y[i] = beta == 0 ? res : res + beta * y[i];
+    }
+}
+
+void gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda,
+          const float* b, size_t ldb, float beta, float* c, size_t ldc) {
+    if (trans_b && !trans_a) { // dot products between the rows of A and the rows of B
+        const KernelTable& ops = get(k);
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                float res = alpha * ops.dot(a + i * lda, b + j * ldb, k);
+                c[i * ldc + j] = beta == 0 ? res : res + beta * c[i * ldc + j];
+            }
+        }
+        return;
+    }
+
+    // each row of C is a linear combination of the rows of B
+    const KernelTable& ops = get(n);
+    for (size_t i = 0; i < m; ++i) {
+        float* c_i = c + i * ldc;
+        scaleOutput(ops, beta, c_i, n);
+        for (size_t l = 0; l < k; ++l) {
+            float a_il = trans_a ? a[l * lda + i] : a[i * lda + l];
+            if (trans_b) {
+                for (size_t j = 0; j < n; ++j) c_i[j] += alpha * a_il * b[j * ldb + l];
+            } else {
+                ops.axpy(alpha * a_il, b + l * ldb, c_i, n);
+            }
+        }
+    }
+}
+
+bool blas() {
+    return false;
+}
+
+#endif
+
+}
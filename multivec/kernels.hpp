@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+/**
+ * Low-level kernels on contiguous float arrays, used by vec.hpp for the dense operations
+ * (dot product, axpy, scaling).
+ *
+ * There are SSE, AVX2 and AVX-512 implementations, compiled with function-level target attributes
+ * (no special compiler flags needed). The best implementation supported by the CPU is selected
+ * once at startup, and a scalar implementation is used as a fallback.
+ *
+ * The training loops get their kernels once with `get(dimension)`: for the common embedding sizes
+ * (50, 100, 128, 200, 300), these are versions compiled for this constant size (fully unrolled loops).
+ *
+ * Matrix products (gemv, gemm) work on row-major matrices whose rows are `ld` floats apart (see Mat::stride).
+ * When compiled with MULTIVEC_BLAS (CMake option of the same name), they call a CBLAS library (e.g., OpenBLAS).
+ * Otherwise, they are loops over the vector kernels.
+ */
+namespace kernels {
+    struct KernelTable {
+        const char* name;
+        size_t size; // size of the vectors these kernels are compiled for (0: any size)
+        float (*dot)(const float* x, const float* y, size_t n);
+        void (*axpy)(float alpha, const float* x, float* y, size_t n);
+        void (*scal)(float alpha, float* x, size_t n);
+    };
+
+    float dot(const float* x, const float* y, size_t n);        // sum of x[i] * y[i]
+    void axpy(float alpha, const float* x, float* y, size_t n);  // y += alpha * x
+    void scal(float alpha, float* x, size_t n);                  // x *= alpha
+
+    const KernelTable& get(size_t n); // kernels for vectors of size n (specialized if possible, generic otherwise)
+
+    // y = alpha * A x + beta * y, with A of size m x n
+    void gemv(size_t m, size_t n, float alpha, const float* a, size_t lda, const float* x, float beta, float* y);
+    // C = alpha * op(A) op(B) + beta * C, with op(A) of size m x k, op(B) of size k x n, op(X) = X^T if trans_x
+    void gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda,
+              const float* b, size_t ldb, float beta, float* c, size_t ldc);
+    bool blas(); // true if the matrix products use CBLAS
+
+    std::string name(); // name of the implementation currently in use
+    bool select(const std::string& name); // force an implementation ("scalar", "sse", "avx2", "avx512")
+}
@@ -0,0 +1,324 @@
+#include "monolingual.hpp"
+#include <getopt.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * Micro-benchmarks of the training and query kernels. Each benchmark is run in a loop whose
+ * size is calibrated to last at least `--min-time` seconds, a few times, and the best time is reported
+ * (in nanoseconds per operation), with the number of bytes allocated per operation.
+ *
+ * The model benchmarks use a model trained for one epoch on a synthetic corpus (Zipf distribution),
+ * which is written to a temporary file. With `--write-corpus`, such a corpus is written to the given file
+ * instead (used by benchmarks/throughput.sh), and no benchmark is run.
+ */
+
+// allocation counter: all the replaceable forms of operator new (there are no aligned forms before C++17),
+// and the buffers of the weight matrices, which Mat allocates with posix_memalign (see Mat::allocationHook)
+static atomic<long long> allocated_bytes(0);
+
+static void* countedAlloc(size_t size) {
+    allocated_bytes.fetch_add(size, memory_order_relaxed);
+    return malloc(size == 0 ? 1 : size);
+}
+
+static void countMatAlloc(size_t size) {
+    allocated_bytes.fetch_add(size, memory_order_relaxed);
+}
+
+void* operator new(size_t size) {
+    void* p = countedAlloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+struct option_plus { // same as option with an additional description field
+    const char *name;
+    int         has_arg;
+    int        *flag;
+    int         val;
+    const char *desc;
+};
+
+static vector<option_plus> options_plus = {
+    {"help",       no_argument,       0, 'h', "print this help message"},
+    {"dimension",  required_argument, 0, 'a', "dimension of the model used by the model benchmarks"},
+    {"vocab-size", required_argument, 0, 'b', "number of distinct words in the synthetic corpus"},
+    {"filter",     required_argument, 0, 'c', "only run the benchmarks whose name contains this string"},
+    {"min-time",   required_argument, 0, 'd', "minimum duration of each measurement (in seconds)"},
+    {"kernels",    required_argument, 0, 'e', "SIMD kernels (scalar, sse, avx2 or avx512, default: best available)"},
+    {"write-corpus", required_argument, 0, 'f', "only write a synthetic corpus (Zipf distribution) to this file"},
+    {"lines",      required_argument, 0, 'g', "number of lines of the synthetic corpus"},
+    {"seed",       required_argument, 0, 'i', "seed of the synthetic corpus"},
+    {0, 0, 0, 0, 0}
+};
+
+void print_usage() {
+    std::cout << "Options:" << std::endl;
+    for (auto it = options_plus.begin(); it != options_plus.end(); ++it) {
+        if (it->name == 0) continue;
+        string name(it->name);
+        if (it->has_arg == required_argument) name += " arg";
+        std::cout << std::setw(26) << std::left << "  --" + name << " " << it->desc << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+static string filter;
+static double min_time = 0.2;
+static volatile float sink; // prevents the compiler from removing the benchmarked computations
+
+/**
+ * @brief Measure the time and memory allocated by one call to `f`, which performs `ops` operations.
+ */
+template <typename F>
+void run(const string& name, F f, long long ops = 1) {
+    if (!filter.empty() && name.find(filter) == string::npos) {
+        return;
+    }
+
+    f(); // warm-up
+
+    long long n = 1;
+    for (;;) {
+        Timer timer;
+        for (long long i = 0; i < n; ++i) f();
+        if (timer.seconds() >= min_time / 4) break;
+        n *= 2;
+    }
+
+    double best = 0;
+    long long bytes = 0;
+    for (int run = 0; run < 3; ++run) {
+        long long bytes_before = allocated_bytes.load();
+        Timer timer;
+        for (long long i = 0; i < n; ++i) f();
+        double seconds = timer.seconds();
+        bytes = allocated_bytes.load() - bytes_before;
+        if (run == 0 || seconds < best) best = seconds;
+    }
+
+    double total_ops = static_cast<double>(n) * ops;
+    printf("%-32s %12.1f ns/op %12.1f B/op\n", name.c_str(), best * 1e9 / total_ops, bytes / total_ops);
+    fflush(stdout);
+}
+
+/**
+ * @brief Write a corpus whose words follow a Zipf distribution (word i has a frequency proportional to 1 / (i + 1)).
+ * The length of the lines is uniform in [1, 2 * words_per_line - 1].
+ */
+static void writeCorpus(const string& filename, int vocab_size, int lines, int words_per_line,
+                        unsigned long long seed = 1) {
+    vector<double> cdf(vocab_size);
+    double sum = 0;
+    for (int i = 0; i < vocab_size; ++i) {
+        sum += 1.0 / (i + 1);
+        cdf[i] = sum;
+    }
+
+    ofstream outfile(filename);
+    check_is_open(outfile, filename);
+    multivec::Random rng(seed);
+
+    for (int line = 0; line < lines; ++line) {
+        int length = 1 + rng() % (2 * words_per_line - 1);
+        for (int j = 0; j < length; ++j) {
+            double x = rng.randf() * sum;
+            int word = std::lower_bound(cdf.begin(), cdf.end(), x) - cdf.begin();
+            outfile << (j == 0 ? "" : " ") << "w" << min(word, vocab_size - 1);
+        }
+        outfile << '\n';
+    }
+}
+
+/**
+ * @brief Benchmarks of the private training functions of MonolingualModel
+ */
+struct ModelBenchmark {
+    static void inVocabulary(MonolingualModel& model, const string& sentence, vector<int>& words) {
+        model.getIndices(sentence, words);
+        words.erase(std::remove(words.begin(), words.end(), -1), words.end());
+    }
+
+    // first line of the corpus with at least one word in the vocabulary (short lines of rare words may have none)
+    static string sentence(MonolingualModel& model, const string& corpus_file) {
+        ifstream infile(corpus_file);
+        check_is_open(infile, corpus_file);
+        string line;
+        vector<int> words;
+        while (getline(infile, line)) {
+            inVocabulary(model, line, words);
+            if (!words.empty()) return line;
+        }
+        throw runtime_error("no word of the corpus is in the vocabulary");
+    }
+
+    static void run(MonolingualModel& model, const string& sentence) {
+        Config* config = model.config;
+        ThreadState state(config->dimension, multivec::Random(config->seed, multivec::TRAINING_STREAM));
+        vector<int> words;
+        inVocabulary(model, sentence, words);
+        size_t n = words.size();
+        size_t k = 0;
+
+        ::run("negSamplingUpdate", [&]() {
+            int input = words[k++ % n], output = words[k++ % n];
+            state.error.fill(0);
+            model.negSamplingUpdate(output, model.input_weights[input], state.error, 0.001f, state);
+        });
+
+        ::run("negSamplingBatchUpdate/input", [&]() {
+            state.batch_inputs.clear();
+            for (int i = 0; i < 2 * config->window_size; ++i) state.batch_inputs.push_back(words[k++ % n]);
+            model.negSamplingBatchUpdate(words[k++ % n], model.input_weights, 0.001f, state);
+        }, 2 * config->window_size);
+
+        ::run("hierarchicalUpdate", [&]() {
+            int input = words[k++ % n], output = words[k++ % n];
+            state.error.fill(0);
+            model.hierarchicalUpdate(output, model.input_weights[input], state.error, 0.001f, state);
+        });
+
+        vector<int> indices;
+        ::run("getIndices+subsample/word", [&]() {
+            model.getIndices(sentence, indices);
+            sink = model.subsample(indices, state.rng, true);
+        }, n);
+
+        vector<StringView> tokens = tokenize(sentence);
+        ::run("Vocabulary::find", [&]() {
+            sink = model.vocabulary.find(tokens[k++ % tokens.size()]);
+        });
+    }
+};
+
+int main(int argc, char **argv) {
+    Mat::allocationHook() = countMatAlloc;
+
+    vector<option> options;
+    for (auto it = options_plus.begin(); it != options_plus.end(); ++it) {
+        option op = {it->name, it->has_arg, it->flag, it->val};
+        options.push_back(op);
+    }
+
+    Config config;
+    config.threads = 1;
+    config.iterations = 1;
+    config.hierarchical_softmax = true; // both output layers are benchmarked
+    int vocab_size = 20000;
+    int lines = 20000;
+    unsigned long long seed = 1;
+    string corpus_file;
+
+    while (1) {
+        int option_index = 0;
+        int opt = getopt_long(argc, argv, "h", options.data(), &option_index);
+        if (opt == -1) break;
+
+        switch (opt) {
+            case 0:                                         break;
+            case 'h': print_usage();                        return 0;
+            case 'a': config.dimension = atoi(optarg);      break;
+            case 'b': vocab_size = atoi(optarg);            break;
+            case 'c': filter = string(optarg);              break;
+            case 'd': min_time = atof(optarg);              break;
+            case 'e':
+                if (!kernels::select(optarg)) throw runtime_error("unknown kernels: " + string(optarg));
+                break;
+            case 'f': corpus_file = string(optarg);         break;
+            case 'g': lines = atoi(optarg);                 break;
+            case 'i': seed = strtoull(optarg, 0, 10);       break;
+            default:                                        abort();
+        }
+    }
+
+    if (!corpus_file.empty()) {
+        writeCorpus(corpus_file, vocab_size, lines, 20, seed);
+        return 0;
+    }
+
+    std::cout << "MultiVec-bench" << std::endl;
+    std::cout << "kernels:     " << kernels::name() << std::endl;
+    std::cout << "BLAS:        " << kernels::blas() << std::endl;
+    std::cout << "dimension:   " << config.dimension << std::endl;
+    std::cout << "vocab size:  " << vocab_size << std::endl;
+    std::cout << std::endl;
+
+    // vector kernels
+    int dimensions[] = {50, 100, 128, 200, 300};
+    for (int d : dimensions) {
+        vec x(d), y(d);
+        for (int i = 0; i < d; ++i) {
+            x[i] = 0.5f - i / static_cast<float>(d);
+            y[i] = 0.1f * i / d;
+        }
+        run("Vec::dot/" + to_string(d), [&]() { sink = x.dot(y); });
+        run("Vec::axpy/" + to_string(d), [&]() { y += 0.001f * x; });
+
+        const kernels::KernelTable& ops = kernels::get(d); // specialized for this dimension
+        run("kernels::get(d).dot/" + to_string(d), [&]() { sink = ops.dot(x.data(), y.data(), d); });
+        run("kernels::get(d).axpy/" + to_string(d), [&]() { ops.axpy(0.001f, x.data(), y.data(), d); });
+    }
+
+    bool model_benchmarks = filter.empty();
+    const char* names[] = {"negSampling", "hierarchical", "getIndices", "Vocabulary", "closest", "save", "load"};
+    for (const char* name : names) {
+        model_benchmarks |= string(name).find(filter) != string::npos || filter.find(name) != string::npos;
+    }
+    if (!model_benchmarks) {
+        return 0;
+    }
+
+    const char* tmp_dir = getenv("TMPDIR");
+    string prefix = string(tmp_dir ? tmp_dir : "/tmp") + "/multivec-bench-" + to_string(getpid());
+    corpus_file = prefix + ".txt";
+    string model_file = prefix + ".bin";
+
+    writeCorpus(corpus_file, vocab_size, lines, 20);
+    MonolingualModel model(&config);
+    {
+        std::streambuf* buf = std::cout.rdbuf(0); // training output isn't part of the report
+        model.train(corpus_file);
+        std::cout.rdbuf(buf);
+    }
+    std::cout << std::endl;
+
+    ModelBenchmark::run(model, ModelBenchmark::sentence(model, corpus_file));
+
+    vector<pair<string, int>> words = model.getWords(); // in decreasing order of frequency
+    size_t n_queries = min<size_t>(words.size(), 100);
+    size_t k = 0;
+    if (words.size() > 1) { // the query word itself isn't in the results
+        run("closest", [&]() { sink = model.closest(words[k++ % n_queries].first, 10)[0].second; });
+    }
+
+    Config load_config;
+    MonolingualModel loaded(&load_config);
+    model.save(model_file); // in case only "load" is selected
+    run("save", [&]() { model.save(model_file); });
+    run("load", [&]() { loaded.load(model_file); });
+
+    remove(corpus_file.c_str());
+    remove(model_file.c_str());
+    return 0;
+}
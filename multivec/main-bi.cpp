@@ -29,6 +29,13 @@ static vector<option_plus> options_plus = {
     {"save",          required_argument, 0, 'p', "save model"},
     {"save-src",      required_argument, 0, 'q', "save source model"},
     {"save-trg",      required_argument, 0, 'r', "save target model"},
+    {"sigmoid-table", required_argument, 0, 's', "size of the sigmoid lookup table (0 for exact sigmoid)"},
+    {"sampler",       required_argument, 0, 't', "negative sampling method (table, alias or cdf)"},
+    {"seed",          required_argument, 0, 'u', "seed of the random generators"},
+    {"train-ids",     no_argument,       0, 'w', "train from pre-tokenized copies of the training files (FILE.ids, created if missing or stale)"},
+    {"vocab-memory",  required_argument, 0, 'x', "memory limit (in MB) for counting the vocabulary, beyond which rare words are pruned (0 for no limit)"},
+    {"stats",         required_argument, 0, 'y', "save training statistics (throughput, time per phase, memory) to this file in JSON format"},
+    {"batch",         no_argument,       0, 'z', "skip-gram with negative sampling: the context words share their negative samples and are updated as a mini-batch"},
     {0, 0, 0, 0, 0}
 };
 
@@ -78,6 +85,7 @@ int main(int argc, char **argv) {
     string save_file;
     string save_src_file;
     string save_trg_file;
+    string stats_file;
 
     optind = 0;  // necessary to parse arguments twice
     while (1) {
@@ -106,6 +114,13 @@ int main(int argc, char **argv) {
             case 'p': save_file = string(optarg);           break;
             case 'q': save_src_file = string(optarg);       break;
             case 'r': save_trg_file = string(optarg);       break;
+            case 's': config.sigmoid_table_size = atoi(optarg); break;
+            case 't': config.sampler = string(optarg);      break;
+            case 'u': config.seed = strtoull(optarg, 0, 10); break;
+            case 'w': config.train_ids = true;              break;
+            case 'x': config.vocab_memory = atoi(optarg);   break;
+            case 'y': stats_file = string(optarg);          break;
+            case 'z': config.batch = true;                  break;
             default:                                        abort();
         }
     }
@@ -122,6 +137,7 @@ int main(int argc, char **argv) {
         model.train(train_src_file, train_trg_file, load_file.empty());
     }
 
+    Timer timer;
     if(!save_file.empty()) {
         model.save(save_file);
     }
@@ -132,5 +148,11 @@ int main(int argc, char **argv) {
         model.trg_model.save(save_trg_file);
     }
 
+    if (!stats_file.empty()) {
+        TrainingStats stats = model.getStats();
+        stats.addPhase("save", timer.seconds());
+        stats.save(stats_file);
+    }
+
     return 0;
 }
@@ -31,6 +31,13 @@ static vector<option_plus> options_plus = {
     {"save-sent-vectors", required_argument, 0, 'r', "save sentence vectors"},
     {"save-vectors-bin",  required_argument, 0, 's', "save word vectors in binary format"},
     {"train-online",      required_argument, 0, 't', "use existing model to train online sentence vectors"},
+    {"sigmoid-table",     required_argument, 0, 'u', "size of the sigmoid lookup table (0 for exact sigmoid)"},
+    {"sampler",           required_argument, 0, 'w', "negative sampling method (table, alias or cdf)"},
+    {"seed",              required_argument, 0, 'x', "seed of the random generators"},
+    {"train-ids",         no_argument,       0, 'y', "train from a pre-tokenized copy of the training file (FILE.ids, created if missing or stale)"},
+    {"vocab-memory",      required_argument, 0, 'z', "memory limit (in MB) for counting the vocabulary, beyond which rare words are pruned (0 for no limit)"},
+    {"stats",             required_argument, 0, 'A', "save training statistics (throughput, time per phase, memory) to this file in JSON format"},
+    {"batch",             no_argument,       0, 'B', "skip-gram with negative sampling: the context words share their negative samples and are updated as a mini-batch"},
     {0, 0, 0, 0, 0}
 };
 
@@ -81,6 +88,7 @@ int main(int argc, char **argv) {
     string save_sent_vectors;
     string save_vectors_bin;
     string online_train_file;
+    string stats_file;
 
     optind = 0;  // necessary to parse arguments twice
     while (1) {
@@ -111,6 +119,13 @@ int main(int argc, char **argv) {
             case 'r': save_sent_vectors = string(optarg);   break;
             case 's': save_vectors_bin = string(optarg);    break;
             case 't': online_train_file = string(optarg);   break;
+            case 'u': config.sigmoid_table_size = atoi(optarg); break;
+            case 'w': config.sampler = string(optarg);      break;
+            case 'x': config.seed = strtoull(optarg, 0, 10); break;
+            case 'y': config.train_ids = true;              break;
+            case 'z': config.vocab_memory = atoi(optarg);   break;
+            case 'A': stats_file = string(optarg);          break;
+            case 'B': config.batch = true;                  break;
             default:                                        abort();
         }
     }
@@ -133,6 +148,7 @@ int main(int argc, char **argv) {
     }
     
     // saving methods (TODO: save model periodically/when training is interrupted)
+    Timer timer;
     if(!save_file.empty()) {
         model.save(save_file);
     }
@@ -146,5 +162,11 @@ int main(int argc, char **argv) {
         model.saveSentVectors(save_sent_vectors);
     }
 
+    if (!stats_file.empty()) {
+        TrainingStats stats = model.getStats();
+        stats.addPhase("save", timer.seconds());
+        stats.save(stats_file);
+    }
+
     return 0;
 }
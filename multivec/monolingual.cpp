@@ -1,189 +1,342 @@
 #include "monolingual.hpp"
 #include "serialization.hpp"
 
-const HuffmanNode HuffmanNode::UNK;
+/**
+ * @brief Create the vocabulary from the word counts, with only the words that appear at least
+ * `config->min_count` times. Indices are assigned by decreasing count (as in word2vec's SortVocab),
+ * so that the rows of the most frequent words are next to each other in the weight matrices.
+ * Ties are broken by alphabetical order, so that indices don't depend on the hash table order.
+ */
+void MonolingualModel::reduceVocab(const WordCounts& counts) {
+    vector<const WordCounts::value_type*> words;
+    for (auto it = counts.begin(); it != counts.end(); ++it) {
+        if (it->second >= config->min_count) {
+            words.push_back(&*it);
+        }
+    }
 
-void MonolingualModel::addWordToVocab(const string& word) {
-    auto it = vocabulary.find(word);
+    std::sort(words.begin(), words.end(), [](const WordCounts::value_type* a, const WordCounts::value_type* b) {
+        return a->second > b->second || (a->second == b->second && a->first < b->first);
+    });
 
-    if (it != vocabulary.end()) {
-        it->second.count++;
-    } else {
-        HuffmanNode node(static_cast<int>(vocabulary.size()), word);
-        vocabulary.insert({word, node});
+    vocabulary.clear();
+    vocabulary.reserve(words.size());
+    for (size_t i = 0; i < words.size(); ++i) {
+        vocabulary.add(words[i]->first, words[i]->second);
     }
 }
 
-void MonolingualModel::reduceVocab() {
-    int i = 0;
-    for (auto it = vocabulary.begin(); it != vocabulary.end(); ) {
-        if ((it->second.count) < config->min_count) {
-            vocabulary.erase(it++);
-        } else {
-            it++->second.index = i++; // reassign indices in [0, vocabulary size - 1)
-        }
+void MonolingualModel::readVocab(const string& training_file) {
+    MappedFile file(training_file);
+    check_is_non_empty(file, training_file);
+
+    CountStats stats;
+    size_t max_size = static_cast<size_t>(config->vocab_memory) * (1 << 20) / WORD_COUNTS_ENTRY_SIZE;
+    WordCounts counts = countWords(file, config->threads, max_size, &stats);
+
+    if (config->verbose) {
+        std::cout << "Vocabulary size: " << counts.size() << std::endl;
+        std::cout << "Vocabulary counts: ~" << stats.peak_size * WORD_COUNTS_ENTRY_SIZE / (1 << 20) << " MB" << std::endl;
+        if (stats.pruned_words > 0)
+            std::cout << "Pruned " << stats.pruned_words << " words (" << stats.pruned_count << " occurrences)"
+                      << ", counts underestimated by at most " << stats.max_error << std::endl;
     }
-}
 
-void MonolingualModel::readVocab(const string& training_file) {
-    ifstream infile(training_file);
+    reduceVocab(counts);
 
-    try {
-        check_is_open(infile, training_file);
-        check_is_non_empty(infile, training_file);
-    } catch (...) {
-        throw;
-    }
+    if (config->verbose)
+        std::cout << "Reduced vocabulary size: " << vocabulary.size()
+                  << " (" << vocabulary.memory() / (1 << 20) << " MB)" << std::endl;
 
-    vocabulary.clear();
+    initWordTables();
+    createBinaryTree();
+    initUnigramTable();
+}
 
-    string word;
-    while (infile >> word) {
-        addWordToVocab(word);
+/**
+ * @brief Hash of the words of the vocabulary and of their indices (FNV-1a). Pre-tokenized corpora
+ * are only valid with the vocabulary they were created with.
+ */
+unsigned long long MonolingualModel::vocabHash() const {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int index = 0; index < vocabulary.size(); ++index) {
+        StringView word = vocabulary.word(index);
+        for (size_t i = 0; i < word.size(); ++i) {
+            hash = (hash ^ static_cast<unsigned char>(word[i])) * 1099511628211ULL;
+        }
+        hash *= 1099511628211ULL; // terminating null character
     }
+    return hash;
+}
 
-    if (config->verbose)
-        std::cout << "Vocabulary size: " << vocabulary.size() << std::endl;
+/**
+ * @brief Return the memory mapping of the pre-tokenized version of a training file (`training_file`.ids).
+ * This file is created if it is missing or stale. Return nullptr if it can't be created, in which case
+ * the text file should be used instead.
+ */
+unique_ptr<MappedFile> MonolingualModel::openIds(const string& training_file) {
+    string ids_file = training_file + ".ids";
+
+    IdsHeader header = {};
+    memcpy(header.magic, IDS_MAGIC, sizeof(header.magic));
+    header.vocab_hash = vocabHash();
+    if (!getFileInfo(training_file, header.source_size, header.source_mtime)) {
+        throw runtime_error("couldn't open file " + training_file);
+    }
 
-    reduceVocab();
+    long long size, mtime;
+    if (getFileInfo(ids_file, size, mtime) && size >= sizeof(IdsHeader)) {
+        unique_ptr<MappedFile> ids(new MappedFile(ids_file));
+        const IdsHeader* current = reinterpret_cast<const IdsHeader*>(ids->data());
+
+        if (memcmp(current->magic, header.magic, sizeof(header.magic)) == 0
+            && current->vocab_hash == header.vocab_hash
+            && current->source_size == header.source_size
+            && current->source_mtime == header.source_mtime) {
+            if (config->verbose)
+                std::cout << "Using pre-tokenized corpus " << ids_file << std::endl;
+            return ids;
+        }
+    }
 
     if (config->verbose)
-        std::cout << "Reduced vocabulary size: " << vocabulary.size() << std::endl;
+        std::cout << "Writing pre-tokenized corpus to " << ids_file << std::endl;
 
-    createBinaryTree();
-    initUnigramTable();
-}
+    if (!writeIds(training_file, ids_file, header)) {
+        std::cout << "Couldn't write " << ids_file << ", training from the text file" << std::endl;
+        return nullptr;
+    }
 
-void MonolingualModel::createBinaryTree() {
-    vector<HuffmanNode*> heap;
-    vector<HuffmanNode> parent_nodes;
-    parent_nodes.reserve(vocabulary.size());
+    return unique_ptr<MappedFile>(new MappedFile(ids_file));
+}
 
-    for (auto it = vocabulary.begin(); it != vocabulary.end(); ++it) {
-        heap.push_back(&it->second);
+/**
+ * @brief Convert a training file into word indices, using the current vocabulary. The file is
+ * written under a temporary name and then renamed, so that `ids_file` is always complete.
+ */
+bool MonolingualModel::writeIds(const string& training_file, const string& ids_file, const IdsHeader& header) const {
+    MappedFile file(training_file);
+    check_is_non_empty(file, training_file);
+
+    string tmp_file = ids_file + ".tmp";
+    ofstream outfile(tmp_file, ios::binary | ios::out);
+    if (!outfile.is_open()) {
+        return false;
     }
 
-    std::sort(heap.begin(), heap.end(), HuffmanNode::comp);
+    IdsHeader ids_header = header;
+    outfile.write(reinterpret_cast<const char*>(&ids_header), sizeof(ids_header));
 
-    for (int i = 0; heap.size() > 1; i++) {
-        HuffmanNode* left = heap.back();
-        heap.pop_back();
+    LineReader reader(file);
+    StringView line;
+    vector<int> indices;
+    while (reader.next(line)) {
+        getIndices(line, indices);
+        indices.push_back(END_OF_SENTENCE);
+        outfile.write(reinterpret_cast<const char*>(indices.data()), sizeof(int) * indices.size());
 
-        HuffmanNode* right = heap.back();
-        heap.pop_back();
+        ids_header.lines += 1;
+        ids_header.words += indices.size() - 1;
+    }
 
-        parent_nodes.push_back({i, left, right});
+    // the counts are only known at the end
+    outfile.seekp(0);
+    outfile.write(reinterpret_cast<const char*>(&ids_header), sizeof(ids_header));
+    outfile.close();
 
-        HuffmanNode* parent = &parent_nodes.back();
-        auto it = lower_bound(heap.begin(), heap.end(), parent, HuffmanNode::comp);
-        heap.insert(it, parent);
+    if (!outfile || rename(tmp_file.c_str(), ids_file.c_str()) != 0) {
+        remove(tmp_file.c_str());
+        return false;
     }
-
-    assignCodes(heap.front(), {}, {});
+    return true;
 }
 
-void MonolingualModel::assignCodes(HuffmanNode* node, vector<int> code, vector<int> parents) const {
-    if (node->is_leaf) {
-        node->code = code;
-        node->parents = parents;
-    } else {
-        parents.push_back(node->index);
-        vector<int> code_left(code);
-        code_left.push_back(0);
-        vector<int> code_right(code);
-        code_right.push_back(1);
+/**
+ * @brief Build the Huffman tree of the vocabulary from the word counts, and write the code and parents
+ * of each word into the flat tables (`code_offsets`, `huffman_codes`, `huffman_parents`).
+ * The tree is built in linear time from the words sorted by count, with two queues: the leaves in
+ * increasing order of count, and the internal nodes, which are created in increasing order of count.
+ * The i-th internal node (parent index i) has node id `v + i`, and the root is the last one.
+ */
+void MonolingualModel::createBinaryTree() {
+    int v = static_cast<int>(word_counts.size());
+
+    // the words are sorted by decreasing count (see reduceVocab), so the leaves in increasing order of count
+    // are the word indices in reverse order
+    vector<int> leaves(v);
+    for (int i = 0; i < v; ++i) leaves[i] = v - 1 - i;
+    assert(std::is_sorted(leaves.begin(), leaves.end(), [this](int a, int b) {
+        return word_counts[a] < word_counts[b];
+    }));
+
+    int n_nodes = max(2 * v - 1, 0);
+    vector<long long> counts(n_nodes);
+    vector<int> parent(n_nodes, -1);
+    vector<char> branch(n_nodes, 0); // 0 for left child, 1 for right child
+    std::copy(word_counts.begin(), word_counts.end(), counts.begin());
+
+    int next_leaf = 0, next_internal = v, n_internal = v;
+    auto pop = [&]() {
+        if (next_leaf < v && (next_internal == n_internal || counts[leaves[next_leaf]] <= counts[next_internal])) {
+            return leaves[next_leaf++];
+        }
+        return next_internal++;
+    };
+
+    for (; n_internal < n_nodes; ++n_internal) {
+        int left = pop();
+        int right = pop();
+
+        counts[n_internal] = counts[left] + counts[right];
+        parent[left] = parent[right] = n_internal;
+        branch[right] = 1;
+    }
+
+    // depth of each node (parents always have a larger id than their children)
+    vector<int> depth(n_nodes, 0);
+    for (int node = n_nodes - 2; node >= 0; --node) {
+        depth[node] = depth[parent[node]] + 1;
+    }
 
-        assignCodes(node->left, code_left, parents);
-        assignCodes(node->right, code_right, parents);
+    code_offsets.assign(v + 1, 0);
+    for (int i = 0; i < v; ++i) {
+        code_offsets[i + 1] = code_offsets[i] + depth[i];
+    }
+    huffman_codes.resize(code_offsets[v]);
+    huffman_parents.resize(code_offsets[v]);
+
+    // codes go from the root to the leaf, so they are written backwards while walking up the tree
+    for (int i = 0; i < v; ++i) {
+        int pos = code_offsets[i + 1];
+        for (int node = i; parent[node] != -1; node = parent[node]) {
+            --pos;
+            huffman_codes[pos] = branch[node];
+            huffman_parents[pos] = parent[node] - v;
+        }
     }
 }
 
 void MonolingualModel::initUnigramTable() {
-    unigram_table.clear();
-    vocab_word_count = 0;
-    
-    float power = 0.75; // weird word2vec tweak ('normal' value would be 1.0)
-    float total_count = 0.0;
-    for (auto it = vocabulary.begin(); it != vocabulary.end(); ++it) {
-        vocab_word_count += it->second.count;
-        total_count += pow(it->second.count, power);
-    }
+    sampler = UnigramSampler(word_counts, config->sampler);
 
-    for (auto it = vocabulary.begin(); it != vocabulary.end(); ++it) {
-        float f = pow(it->second.count, power) / total_count;
+    if (config->verbose)
+        std::cout << "Negative sampling method: " << sampler.method()
+                  << " (" << sampler.memory() / (1 << 20) << " MB)" << std::endl;
+}
 
-        int d = static_cast<int>(f * UNIGRAM_TABLE_SIZE);
-        for (int i = 0; i < d; ++i) {
-            unigram_table.push_back(&it->second);
-        }
+/**
+ * @brief Copy the counts of all the words into a flat array indexed by word index, so that the
+ * training loop doesn't need to access the vocabulary (the Huffman codes are already in flat arrays).
+ */
+void MonolingualModel::initWordTables() {
+    word_counts.assign(vocabulary.size(), 0);
+    vocab_word_count = 0;
+
+    for (int i = 0; i < vocabulary.size(); ++i) {
+        vocab_word_count += vocabulary.count(i);
+        word_counts[i] = vocabulary.count(i);
     }
+
+    initSubsampling();
 }
 
-HuffmanNode* MonolingualModel::getRandomHuffmanNode() {
-    auto index = multivec::rand() % unigram_table.size();
-    return unigram_table[index];
+int MonolingualModel::getRandomWord(multivec::Random& rng) const {
+    return sampler.sample(rng() >> 16);
 }
 
-void MonolingualModel::initNet() {
-    int v = static_cast<int>(vocabulary.size());
+void MonolingualModel::initNet(int stream) {
+    int v = vocabulary.size();
     int d = config->dimension;
+    multivec::Random rng(config->seed, stream);
 
-    input_weights = mat(v, vec(d));
+    input_weights = mat(v, d);
 
     for (size_t row = 0; row < v; ++row) {
         for (size_t col = 0; col < d; ++col) {
-            input_weights[row][col] = (multivec::randf() - 0.5f) / d;
+            input_weights[row][col] = (rng.randf() - 0.5f) / d;
         }
     }
 
-    output_weights_hs = mat(v, vec(d));
-    output_weights = mat(v, vec(d));
+    output_weights_hs = mat(v, d);
+    output_weights = mat(v, d);
+}
+
+void MonolingualModel::initSigmoidTable() {
+    if (sigmoid_table.size() != config->sigmoid_table_size) {
+        sigmoid_table.init(config->sigmoid_table_size);
+    }
 }
 
 void MonolingualModel::initSentWeights() {
     int d = config->dimension;
-    sent_weights = mat(training_lines, vec(d));
+    sent_weights = mat(training_lines, d);
+    multivec::Random rng(config->seed, multivec::SENT_WEIGHTS_STREAM);
 
     for (size_t row = 0; row < training_lines; ++row) {
         for (size_t col = 0; col < d; ++col) {
-            sent_weights[row][col] = (multivec::randf() - 0.5f) / d;
+            sent_weights[row][col] = (rng.randf() - 0.5f) / d;
         }
     }
 }
 
-vector<HuffmanNode> MonolingualModel::getNodes(const string& sentence) const {
-    vector<HuffmanNode> nodes;
-    istringstream iss(sentence);
-    string word;
-
-    while (iss >> word) {
-        auto it = vocabulary.find(word);
-        HuffmanNode node = HuffmanNode::UNK;
+/**
+ * @brief Fill `indices` with the index of each word of the sentence (-1 for OOV words).
+ */
+void MonolingualModel::getIndices(StringView sentence, vector<int>& indices) const {
+    indices.clear();
+    StringView token;
 
-        if (it != vocabulary.end()) {
-            node = it->second;
-        }
+    while (nextToken(sentence, token)) {
+        indices.push_back(vocabulary.find(token));
+    }
+}
 
-        nodes.push_back(node);
+/**
+ * @brief Compute the probability of discarding each word (word2vec formula), as a threshold on a 32-bit
+ * random integer, so that subsample doesn't need any floating point computation.
+ */
+void MonolingualModel::initSubsampling() {
+    subsampling_rate = config->subsampling;
+    discard_thresholds.assign(word_counts.size(), 0);
+    if (subsampling_rate <= 0) {
+        return;
     }
 
-    return nodes;
+    for (size_t i = 0; i < word_counts.size(); ++i) {
+        double f = static_cast<double>(word_counts[i]) / vocab_word_count; // frequency of this word
+        double p = 1 - (1 + sqrt(f / subsampling_rate)) * subsampling_rate / f;
+        p = min(max(p, 0.0), 1.0);
+        discard_thresholds[i] = static_cast<unsigned int>(min(p * 4294967296.0, 4294967295.0));
+    }
 }
 
 /**
- * @brief Discard random nodes according to their frequency. The more frequent a word is, the more
- * likely it is to be discarded. Discarded nodes are replaced by UNK token.
+ * @brief Discard random words according to their frequency. The more frequent a word is, the more
+ * likely it is to be discarded. Discarded words are replaced by -1 (same as OOV words), or with
+ * `remove` set to true, removed from `indices` along with the OOV words.
+ *
+ * @return number of words of the sentence that are in the vocabulary, discarded or not (for progress estimation)
  */
-void MonolingualModel::subsample(vector<HuffmanNode>& nodes) const {
-    for (auto it = nodes.begin(); it != nodes.end(); ++it) {
-        auto node = *it;
-        float f = static_cast<float>(node.count) / vocab_word_count; // frequency of this word
-        float p = 1 - (1 + sqrt(f / config->subsampling)) * config->subsampling / f; // word2vec formula
-
-        if (p >= multivec::randf()) {
-            *it = HuffmanNode::UNK;
+int MonolingualModel::subsample(vector<int>& indices, multivec::Random& rng, bool remove) const {
+    int word_count = 0;
+    auto out = indices.begin();
+
+    for (auto it = indices.begin(); it != indices.end(); ++it) {
+        int word = *it;
+        if (word != -1) {
+            ++word_count;
+            unsigned int threshold = discard_thresholds[word];
+            if (threshold != 0 && (rng() >> 32) < threshold) {
+                word = -1;
+            }
+        }
+        if (word != -1 || !remove) {
+            *out++ = word;
         }
     }
+
+    indices.erase(out, indices.end());
+    return word_count;
 }
 
 void MonolingualModel::saveVectorsBin(const string &filename, int policy) const {
@@ -200,10 +353,10 @@ void MonolingualModel::saveVectorsBin(const string &filename, int policy) const
 
     outfile << vocabulary.size() << " " << config->dimension << endl;
 
-    for (auto it = vocabulary.begin(); it != vocabulary.end(); ++it) {
-        string word = string(it->second.word);
+    for (int index = 0; index < vocabulary.size(); ++index) { // most frequent words first
+        string word = vocabulary.word(index).str();
         word.push_back(' ');
-        vec embedding = wordVec(it->second.index, policy);
+        vec embedding = wordVec(index, policy);
 
         outfile.write(word.c_str(), word.size());
         outfile.write(reinterpret_cast<const char*>(embedding.data()), sizeof(float) * config->dimension);
@@ -225,9 +378,9 @@ void MonolingualModel::saveVectors(const string &filename, int policy) const {
 
     outfile << vocabulary.size() << " " << config->dimension << endl;
 
-    for (auto it = vocabulary.begin(); it != vocabulary.end(); ++it) {
-        outfile << it->second.word << " ";
-        vec embedding = wordVec(it->second.index, policy);
+    for (int index = 0; index < vocabulary.size(); ++index) { // most frequent words first
+        outfile << vocabulary.word(index).str() << " ";
+        vec embedding = wordVec(index, policy);
         for (int c = 0; c < config->dimension; ++c) {
             outfile << embedding[c] << " ";
         }
@@ -247,8 +400,8 @@ void MonolingualModel::saveSentVectors(const string &filename) const {
         throw;
     }
 
-    for (auto it = sent_weights.begin(); it != sent_weights.end(); ++it) {
-        vec embedding = *it;
+    for (size_t i = 0; i < sent_weights.size(); ++i) {
+        auto embedding = sent_weights[i];
         for (int c = 0; c < config->dimension; ++c) {
             outfile << embedding[c] << " ";
         }
@@ -269,6 +422,7 @@ void MonolingualModel::load(const string& filename) {
     }
 
     ::load(infile, *this);
+    initWordTables();
     initUnigramTable();
     if (config->verbose)
         std::cout << "Vocabulary size: " << vocabulary.size() << std::endl;
@@ -289,6 +443,10 @@ void MonolingualModel::save(const string& filename) const {
     ::save(outfile, *this);
 }
 
+int MonolingualModel::wordVecSize(int policy) const {
+    return policy == 1 && config->negative > 0 ? 2 * config->dimension : config->dimension;
+}
+
 vec MonolingualModel::wordVec(int index, int policy) const {
     if (policy == 1 && config->negative > 0) // concat input and output
     {
@@ -323,13 +481,13 @@ vec MonolingualModel::wordVec(int index, int policy) const {
  * 3: output weights only.
  * @return vec
  */
-vec MonolingualModel::wordVec(const string& word, int policy) const {
-    auto it = vocabulary.find(word);
+vec MonolingualModel::wordVec(StringView word, int policy) const {
+    int index = vocabulary.find(word);
 
-    if (it == vocabulary.end()) {
+    if (index == -1) {
         throw runtime_error("out of vocabulary");
     } else {
-        return wordVec(it->second.index, policy);
+        return wordVec(index, policy);
     }
 }
 
@@ -363,39 +521,43 @@ vec MonolingualModel::sentVec(const string& sentence) {
     int dimension = config->dimension;
     float alpha = config->learning_rate;  // TODO: decreasing learning rate
 
-    auto nodes = getNodes(sentence);  // no subsampling here
-    nodes.erase(
-        remove(nodes.begin(), nodes.end(), HuffmanNode::UNK),
-        nodes.end()); // remove UNK tokens
+    vector<int> words;
+    getIndices(sentence, words);  // no subsampling here
+    words.erase(remove(words.begin(), words.end(), -1), words.end()); // remove OOV words
 
-    if (nodes.empty())
+    if (words.empty())
         throw runtime_error("too short sentence, or OOV words");
 
+    initSigmoidTable();
+
     vec sent_vec(dimension, 0);
+    ThreadState state(dimension, multivec::Random(config->seed, multivec::INFERENCE_STREAM));
+    vec& hidden = state.hidden;
+    vec& error = state.error;
 
     for (int k = 0; k < config->iterations; ++k) {
-        for (int word_pos = 0; word_pos < nodes.size(); ++word_pos) {
-            vec hidden(dimension, 0);
-            HuffmanNode cur_node = nodes[word_pos];
+        for (int word_pos = 0; word_pos < words.size(); ++word_pos) {
+            hidden.fill(0);
+            int cur_word = words[word_pos];
 
-            int this_window_size = 1 + multivec::rand() % config->window_size;
+            int this_window_size = 1 + state.rng() % config->window_size;
             int count = 0;
 
             for (int pos = word_pos - this_window_size; pos <= word_pos + this_window_size; ++pos) {
-                if (pos < 0 || pos >= nodes.size() || pos == word_pos) continue;
-                hidden += input_weights[nodes[pos].index];
+                if (pos < 0 || pos >= words.size() || pos == word_pos) continue;
+                hidden += input_weights[words[pos]];
                 ++count;
             }
 
             if (count == 0) continue;
             hidden = (hidden + sent_vec) / (count + 1); // TODO this or (hidden / count) + sent_vec?
 
-            vec error(dimension, 0);
+            error.fill(0);
             if (config->hierarchical_softmax) {
-                error += hierarchicalUpdate(cur_node, hidden, alpha, false);
+                hierarchicalUpdate(cur_word, hidden, error, alpha, state, false);
             }
             if (config->negative > 0) {
-                error += negSamplingUpdate(cur_node, hidden, alpha, false);
+                negSamplingUpdate(cur_word, hidden, error, alpha, state, false);
             }
 
             sent_vec += error;
@@ -407,8 +569,8 @@ vec MonolingualModel::sentVec(const string& sentence) {
 
 
 /**
- * @brief Train model using given text file. Training is performed in parallel (each
- * thread reads one chunk of the file). Learning rate decays to zero.
+ * @brief Train model using given text file. Training is performed in parallel: the file is split
+ * into blocks, which the threads claim one after the other (see trainThread). Learning rate decays to zero.
  * Before calling this method, you need to call initialize or load, to initialize
  * the model parameters (vocabulary, unigram table, weights, etc.)
  *
@@ -419,43 +581,75 @@ vec MonolingualModel::sentVec(const string& sentence) {
 void MonolingualModel::train(const string& training_file, bool initialize) {
     std::cout << "Training file: " << training_file << std::endl;
 
+    stats.clear();
+    Timer timer;
+
     if (initialize) {
         if (config->verbose)
             std::cout << "Creating new model" << std::endl;
 
         // reads vocab and initializes unigram table
         readVocab(training_file);
+        stats.addPhase("vocab", timer.seconds());
+
+        timer.reset();
         initNet();
+        stats.addPhase("init", timer.seconds());
     } else if (vocab_word_count == 0) {
         // TODO: check that everything is initialized, and dimension is OK
         throw runtime_error("the model needs to be initialized before training");
     }
 
-    // TODO: also serialize training state
-    words_processed = 0;
-    alpha = config->learning_rate;
+    // the training threads all read from the same memory mapping of the file (or of its pre-tokenized version)
+    timer.reset();
+    unique_ptr<MappedFile> corpus;
+    if (config->train_ids)
+        corpus = openIds(training_file);
+
+    bool pretokenized = corpus != nullptr;
+    if (!pretokenized)
+        corpus.reset(new MappedFile(training_file));
 
-    // read file to find out the beginning of each chunk
+    // read file to find out the beginning of each block
     // also counts the number of lines and words
-    auto chunks = chunkify(training_file, config->threads);
+    auto chunks = chunkify(*corpus, pretokenized, training_file, trainingBlocks(corpus->size(), config->threads));
+    stats.addPhase("chunkify", timer.seconds());
 
     if (config->verbose)
         std::cout << "Number of lines: " << training_lines
                   << ", words: " << training_words << std::endl;
 
+    timer.reset();
     if (config->sent_vector)
         // no incremental training for paragraph vector
         initSentWeights();
 
+    if (sampler.method() != config->sampler)
+        initUnigramTable();
+    if (subsampling_rate != config->subsampling)
+        initSubsampling();
+    initSigmoidTable();
+    stats.addPhase("init", timer.seconds());
+
+    // TODO: also serialize training state
+    TrainingProgress progress(config->threads, config->iterations, chunks.size(), config->iterations * training_words,
+                              config->learning_rate);
+    stats.threads.resize(config->threads);
+    if (config->verbose)
+        progress.startReporter();
+
     high_resolution_clock::time_point start = high_resolution_clock::now();
+    atomic<long long> next_job(0);
+    ChunkTrainer train_chunk = chunkTrainer();
     if (config->threads == 1) {
-        trainChunk(training_file, chunks, 0);
+        trainThread(*corpus, pretokenized, chunks, 0, next_job, progress, train_chunk);
     } else {
         vector<thread> threads;
 
         for (int i = 0; i < config->threads; ++i) {
-            threads.push_back(thread(&MonolingualModel::trainChunk, this,
-                training_file, chunks, i));
+            threads.push_back(thread(&MonolingualModel::trainThread, this,
+                std::cref(*corpus), pretokenized, std::cref(chunks), i, std::ref(next_job), std::ref(progress),
+                train_chunk));
         }
 
         for (auto it = threads.begin(); it != threads.end(); ++it) {
@@ -465,222 +659,253 @@ void MonolingualModel::train(const string& training_file, bool initialize) {
     high_resolution_clock::time_point end = high_resolution_clock::now();
     auto duration = duration_cast<microseconds>(end - start).count();
 
-    if (config->verbose)
+    if (config->verbose) {
+        progress.stopReporter();
         std::cout << std::endl;
+    }
+
+    stats.addPhase("train", static_cast<double>(duration) / 1000000);
+    stats.epochs = progress.epochDurations();
 
     std::cout << "Training time: " << static_cast<float>(duration) / 1000000 << std::endl;
 }
 
 /**
- * @brief Divide a given file into chunks with the same number of lines each
+ * @brief Divide a given file into chunks of about the same size, and count its lines and words (in parallel)
  *
- * @param filename path of the file
+ * @param file memory mapping of the file
+ * @param pretokenized true if the file is a pre-tokenized corpus
+ * @param filename path of the file (for error messages)
  * @param n_chunks number of chunks
- * @return starting position (in bytes) of each chunk
+ * @return position (in bytes) and first line of each chunk
  */
-vector<long long> MonolingualModel::chunkify(const string& filename, int n_chunks) {
-    ifstream infile(filename);
+vector<Chunk> MonolingualModel::chunkify(const MappedFile& file, bool pretokenized, const string& filename, int n_chunks) {
+    check_is_non_empty(file, filename);
 
-    try {
-        check_is_open(infile, filename);
-        check_is_non_empty(infile, filename);
-    } catch (...) {
-        throw;
-    }
+    vector<Chunk> chunks = splitCorpus(file, pretokenized, n_chunks, config->threads);
 
-    vector<long long> chunks;
-    vector<long long> line_positions;
-    long long words = 0;
-
-    string line;
-    do {
-        line_positions.push_back(static_cast<long long>(infile.tellg()));
-        words += split(line).size();
-    } while (getline(infile, line));
-    words += split(line).size();
-
-    training_lines = line_positions.size() - 1;
-    training_words = words;
-    int chunk_size = line_positions.size() / n_chunks;  // number of lines in each chunk
-
-    for (int i = 0; i < n_chunks; i++) {
-        long long chunk_start = line_positions[i * chunk_size];
-        chunks.push_back(chunk_start);
+    training_lines = 0;
+    training_words = 0;
+    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+        training_lines += it->lines;
+        training_words += it->words;
     }
 
     return chunks;
 }
 
-void MonolingualModel::trainChunk(const string& training_file,
-                                  const vector<long long>& chunks,
-                                  int chunk_id) {
-    ifstream infile(training_file);
-    float starting_alpha = config->learning_rate;
-    int max_iterations = config->iterations;
-
-    try {
-        check_is_open(infile, training_file);
-        check_is_non_empty(infile, training_file);
-    } catch (...) {
-        throw;
+/**
+ * @brief Training loop of a thread: claim the next block of the corpus (shared counter `next_job`)
+ * and train on it, until all the blocks have been processed for all the epochs. Job j is block
+ * j % n_blocks of epoch j / n_blocks, so the threads move to the next epoch without waiting for each other.
+ */
+void MonolingualModel::trainThread(const MappedFile& corpus,
+                                   bool pretokenized,
+                                   const vector<Chunk>& chunks,
+                                   int thread_id,
+                                   atomic<long long>& next_job,
+                                   TrainingProgress& progress,
+                                   ChunkTrainer train_chunk) {
+    ThreadState state(config->dimension, multivec::Random(config->seed, multivec::TRAINING_STREAM + thread_id),
+                      thread_id);
+    long long n_jobs = static_cast<long long>(config->iterations) * chunks.size();
+
+    for (long long job = next_job++; job < n_jobs; job = next_job++) {
+        progress.blockStarted(job);
+        (this->*train_chunk)(corpus, pretokenized, chunks[job % chunks.size()], state, progress);
+        progress.blockDone(job);
     }
 
-    for (int k = 0; k < max_iterations; ++k) {
-        int word_count = 0, last_count = 0;
+    state.stats.words = state.word_count;
+    stats.threads[thread_id] = state.stats;
+}
 
-        infile.clear();
-        infile.seekg(chunks[chunk_id], infile.beg);
+MonolingualModel::ChunkTrainer MonolingualModel::chunkTrainer() const {
+    static const ChunkTrainer trainers[] = {
+        &MonolingualModel::trainChunk<TrainingMode<false, false, false>>,
+        &MonolingualModel::trainChunk<TrainingMode<false, false, true>>,
+        &MonolingualModel::trainChunk<TrainingMode<false, true, false>>,
+        &MonolingualModel::trainChunk<TrainingMode<false, true, true>>,
+        &MonolingualModel::trainChunk<TrainingMode<true, false, false>>,
+        &MonolingualModel::trainChunk<TrainingMode<true, false, true>>,
+        &MonolingualModel::trainChunk<TrainingMode<true, true, false>>,
+        &MonolingualModel::trainChunk<TrainingMode<true, true, true>>
+    };
+
+    if (config->batch && config->skip_gram && config->negative > 0) {
+        return config->hierarchical_softmax ? &MonolingualModel::trainChunk<TrainingMode<true, true, true, true>>
+                                            : &MonolingualModel::trainChunk<TrainingMode<true, false, true, true>>;
+    }
+    return trainers[4 * config->skip_gram + 2 * config->hierarchical_softmax + (config->negative > 0)];
+}
 
-        int chunk_size = training_lines / chunks.size();
-        int sent_id = chunk_id * chunk_size;
+template <class Mode>
+void MonolingualModel::trainChunk(const MappedFile& corpus,
+                                  bool pretokenized,
+                                  const Chunk& chunk,
+                                  ThreadState& state,
+                                  TrainingProgress& progress) {
+    long long last_count = state.word_count;
+    state.alpha = progress.alpha();
 
-        string sent;
-        while (getline(infile, sent)) {
-            word_count += trainSentence(sent, sent_id++); // asynchronous update (possible race conditions)
+    int sent_id = chunk.first_line;
 
-            // update learning rate
-            if (word_count - last_count > 10000) {
-                words_processed += word_count - last_count; // asynchronous update
-                last_count = word_count;
+    // time spent reading vs training (tokenization and vocabulary lookups are counted as reading)
+    typedef high_resolution_clock Clock;
+    Clock::time_point read_start = Clock::now();
 
-                // decreasing learning rate
-                alpha = starting_alpha * (1 - static_cast<float>(words_processed) / (max_iterations * training_words));
-                alpha = max(alpha, starting_alpha * 0.0001f);
+    SentenceReader reader(*this, corpus, pretokenized, chunk.begin, chunk.end);
+    while (reader.next(state.words)) {
+        Clock::time_point train_start = Clock::now();
+        state.stats.io_time += duration<double>(train_start - read_start).count();
 
-                if (config->verbose) {
-                    printf("\rAlpha: %f  Progress: %.2f%%", alpha, 100.0 * words_processed /
-                                    (max_iterations * training_words));
-                    fflush(stdout);
-                }
-            }
+        state.word_count += trainSentence<Mode>(state.words, sent_id++, state); // asynchronous update (possible race conditions)
 
-            // stop when reaching the end of a chunk
-            if (chunk_id < chunks.size() - 1 && infile.tellg() >= chunks[chunk_id + 1])
-                break;
-        }
+        read_start = Clock::now();
+        state.stats.compute_time += duration<double>(read_start - train_start).count();
 
-        words_processed += word_count - last_count;
+        // update learning rate
+        if (state.word_count - last_count > 10000) {
+            last_count = state.word_count;
+            state.alpha = progress.update(state.id, state.word_count);
+        }
     }
-}
 
-int MonolingualModel::trainSentence(const string& sent, int sent_id) {
-    auto nodes = getNodes(sent);  // same size as sent, OOV words are replaced by <UNK>
+    progress.update(state.id, state.word_count);
+}
 
-    // counts the number of words that are in the vocabulary
-    int words = nodes.size() - count(nodes.begin(), nodes.end(), HuffmanNode::UNK);
+template <class Mode>
+int MonolingualModel::trainSentence(vector<int>& words, int sent_id, ThreadState& state) {
+    // `words` has the same size as the sentence, OOV words are replaced by -1
 
-    if (config->subsampling > 0) {
-        subsample(nodes); // puts <UNK> tokens in place of the discarded tokens
-    }
+    // removes OOV and discarded words, and counts the number of words that are in the vocabulary
+    int word_count = subsample(words, state.rng, true);
 
-    if (nodes.empty()) {
-        return words;
+    if (words.empty()) {
+        return word_count;
     }
 
-    // remove <UNK> tokens
-    nodes.erase(
-        remove(nodes.begin(), nodes.end(), HuffmanNode::UNK),
-        nodes.end());
-
     // Monolingual training
-    for (int pos = 0; pos < nodes.size(); ++pos) {
-        trainWord(nodes, pos, sent_id);
+    for (int pos = 0; pos < words.size(); ++pos) {
+        if (Mode::skip_gram) {
+            trainWordSkipGram<Mode>(words, pos, sent_id, state);
+        } else {
+            trainWordCBOW<Mode>(words, pos, sent_id, state);
+        }
     }
 
-    return words; // returns the number of words processed, for progress estimation
-}
-
-void MonolingualModel::trainWord(const vector<HuffmanNode>& nodes, int word_pos, int sent_id) {
-    if (config->skip_gram) {
-        trainWordSkipGram(nodes, word_pos, sent_id);
-    } else {
-        trainWordCBOW(nodes, word_pos, sent_id);
-    }
+    return word_count; // returns the number of words processed, for progress estimation
 }
 
-void MonolingualModel::trainWordCBOW(const vector<HuffmanNode>& nodes, int word_pos, int sent_id) {
-    int dimension = config->dimension;
-    vec hidden(dimension, 0);
-    HuffmanNode cur_node = nodes[word_pos];
+template <class Mode>
+void MonolingualModel::trainWordCBOW(const vector<int>& words, int word_pos, int sent_id, ThreadState& state) {
+    const kernels::KernelTable& ops = *state.ops;
+    int d = config->dimension;
+    vec& hidden = state.hidden;
+    vec& error = state.error;
+    hidden.fill(0);
+    int cur_word = words[word_pos];
 
-    int this_window_size = 1 + multivec::rand() % config->window_size; // reduced window
+    int this_window_size = 1 + state.rng() % config->window_size; // reduced window
     int count = 0;
 
     for (int pos = word_pos - this_window_size; pos <= word_pos + this_window_size; ++pos) {
-        if (pos < 0 || pos >= nodes.size() || pos == word_pos) continue;
-        hidden += input_weights[nodes[pos].index];
+        if (pos < 0 || pos >= words.size() || pos == word_pos) continue;
+        ops.axpy(1, input_weights[words[pos]].data(), hidden.data(), d);
         ++count;
     }
 
     if (config->sent_vector) {
-        hidden += sent_weights[sent_id];
+        ops.axpy(1, sent_weights[sent_id].data(), hidden.data(), d);
         ++count;
     }
 
     if (count == 0) return;
-    hidden /= count;
+    ops.scal(1.0f / count, hidden.data(), d);
 
-    vec error(dimension, 0);
-    if (config->hierarchical_softmax) {
-        error += hierarchicalUpdate(cur_node, hidden, alpha);
+    error.fill(0);
+    if (Mode::hierarchical_softmax) {
+        hierarchicalUpdate(cur_word, hidden, error, state.alpha, state);
     }
-    if (config->negative > 0) {
-        error += negSamplingUpdate(cur_node, hidden, alpha);
+    if (Mode::negative_sampling) {
+        negSamplingUpdate(cur_word, hidden, error, state.alpha, state);
     }
 
     // update input weights
     for (int pos = word_pos - this_window_size; pos <= word_pos + this_window_size; ++pos) {
-        if (pos < 0 || pos >= nodes.size() || pos == word_pos) continue;
-        input_weights[nodes[pos].index] += error;
+        if (pos < 0 || pos >= words.size() || pos == word_pos) continue;
+        ops.axpy(1, error.data(), input_weights[words[pos]].data(), d);
     }
 
     if (config->sent_vector) {
-        sent_weights[sent_id] += error;
+        ops.axpy(1, error.data(), sent_weights[sent_id].data(), d);
     }
 }
 
-void MonolingualModel::trainWordSkipGram(const vector<HuffmanNode>& nodes, int word_pos, int sent_id) {
-    int dimension = config->dimension;
-    HuffmanNode input_word = nodes[word_pos]; // use this word to predict surrounding words
+template <class Mode>
+void MonolingualModel::trainWordSkipGram(const vector<int>& words, int word_pos, int sent_id, ThreadState& state) {
+    const kernels::KernelTable& ops = *state.ops;
+    int d = config->dimension;
+    vec& error = state.error;
+    int input_word = words[word_pos]; // use this word to predict surrounding words
+
+    int this_window_size = 1 + state.rng() % config->window_size;
 
-    int this_window_size = 1 + multivec::rand() % config->window_size;
+    if (Mode::batch) {
+        // the context words predict the current word (like in word2vec), with shared negative samples
+        state.batch_inputs.clear();
+        for (int pos = word_pos - this_window_size; pos <= word_pos + this_window_size; ++pos) {
+            if (pos < 0 || pos >= words.size() || pos == word_pos) continue;
+            state.batch_inputs.push_back(words[pos]);
+        }
+        if (!state.batch_inputs.empty()) {
+            negSamplingBatchUpdate(input_word, input_weights, state.alpha, state);
+        }
+        if (!Mode::hierarchical_softmax) return;
+    }
 
     for (int pos = word_pos - this_window_size; pos <= word_pos + this_window_size; ++pos) {
         int p = pos;
         if (p == word_pos) continue;
-        if (p < 0 || p >= nodes.size()) continue;
-        HuffmanNode output_word = nodes[p];
+        if (p < 0 || p >= words.size()) continue;
+        int output_word = words[p];
 
-        vec error(dimension, 0);
-        if (config->hierarchical_softmax) {
-            error += hierarchicalUpdate(output_word, input_weights[input_word.index], alpha);
+        error.fill(0);
+        if (Mode::hierarchical_softmax) {
+            hierarchicalUpdate(output_word, input_weights[input_word], error, state.alpha, state);
         }
-        if (config->negative > 0) {
-            error += negSamplingUpdate(output_word, input_weights[input_word.index], alpha);
+        if (Mode::negative_sampling && !Mode::batch) {
+            negSamplingUpdate(output_word, input_weights[input_word], error, state.alpha, state);
         }
 
-        input_weights[input_word.index] += error;
+        ops.axpy(1, error.data(), input_weights[input_word].data(), d);
     }
 }
 
-vec MonolingualModel::negSamplingUpdate(const HuffmanNode& node, const vec& hidden, float alpha, bool update) {
-    int dimension = config->dimension;
-    vec temp(dimension, 0);
+void MonolingualModel::negSamplingUpdate(int word, ConstVecRef hidden, VecRef error,
+                                         float alpha, ThreadState& state, bool update) {
+    const kernels::KernelTable& ops = *state.ops;
+    size_t d = hidden.size();
 
-    for (int d = 0; d < config->negative + 1; ++d) {
+    for (int k = 0; k < config->negative + 1; ++k) {
         int label;
-        const HuffmanNode* target;
+        int target;
 
-        if (d == 0) { // 1 positive example
-            target = &node;
+        if (k == 0) { // 1 positive example
+            target = word;
             label = 1;
         } else { // n negative examples
-            target = getRandomHuffmanNode();
-            if (*target == node) continue;
+            target = getRandomWord(state.rng);
+            ++state.stats.negative_samples;
+            if (target == word) {
+                ++state.stats.rejected_samples;
+                continue;
+            }
             label = 0;
         }
 
-        float x = hidden.dot(output_weights[target->index]);
+        float* weights = output_weights[target].data();
+        float x = ops.dot(hidden.data(), weights, d);
 
         float pred;
         if (x >= MAX_EXP) {
@@ -688,49 +913,127 @@ vec MonolingualModel::negSamplingUpdate(const HuffmanNode& node, const vec& hidd
         } else if (x <= -MAX_EXP) {
             pred = 0;
         } else {
-            pred = sigmoid(x);
+            pred = sigmoid_table(x);
         }
-        float error = alpha * (label - pred);
+        float g = alpha * (label - pred);
 
-        temp += error * output_weights[target->index];
+        ops.axpy(g, weights, error.data(), d);
 
         if (update)
-            output_weights[target->index] += error * hidden;
+            ops.axpy(g, hidden.data(), weights, d);
     }
+}
 
-    return temp;
+/**
+ * @brief Negative sampling with a mini-batch of inputs (pWord2Vec, Ji et al., 2016): the inputs (e.g., the context
+ * of a word) all predict the same word, with the same negative samples. The inputs and outputs are copied
+ * into small contiguous matrices, and the update is a product of these matrices: all the scores
+ * (n_inputs x n_outputs) are computed first, then the gradients of the inputs and outputs, which are
+ * finally added to the weights.
+ */
+void MonolingualModel::negSamplingBatchUpdate(int word, mat& input_weights, float alpha, ThreadState& state) {
+    const kernels::KernelTable& ops = *state.ops;
+    size_t d = config->dimension;
+    const vector<int>& inputs = state.batch_inputs;
+    vector<int>& outputs = state.batch_outputs;
+
+    // outputs: 1 positive example, then n negative examples
+    outputs.assign(1, word);
+    for (int k = 0; k < config->negative; ++k) {
+        int target = getRandomWord(state.rng);
+        ++state.stats.negative_samples;
+        if (target == word) {
+            ++state.stats.rejected_samples;
+            continue;
+        }
+        outputs.push_back(target);
+    }
+
+    size_t n_inputs = inputs.size(), n_outputs = outputs.size();
+    if (state.input_batch.rows() < n_inputs || state.input_batch.cols() != d) {
+        size_t max_inputs = std::max<size_t>(n_inputs, 2 * config->window_size);
+        state.input_batch = mat(max_inputs, d);
+        state.input_grads = mat(max_inputs, d);
+    }
+    if (state.output_batch.rows() < n_outputs || state.output_batch.cols() != d) {
+        state.output_batch = mat(config->negative + 1, d);
+        state.output_grads = mat(config->negative + 1, d);
+    }
+
+    for (size_t i = 0; i < n_inputs; ++i) {
+        state.input_batch[i] = input_weights[inputs[i]];
+    }
+    for (size_t j = 0; j < n_outputs; ++j) {
+        state.output_batch[j] = output_weights[outputs[j]];
+    }
+
+    const float* in = state.input_batch.data();
+    const float* out = state.output_batch.data();
+    size_t ld = state.input_batch.stride(); // same stride for all the matrices (same number of columns)
+
+    // gradients of the scores: G = alpha * (labels - sigmoid(inputs x outputs^T))
+    vector<float>& gradients = state.batch_gradients;
+    gradients.resize(n_inputs * n_outputs);
+    kernels::gemm(false, true, n_inputs, n_outputs, d, 1, in, ld, out, ld, 0, gradients.data(), n_outputs);
+
+    for (size_t i = 0; i < n_inputs; ++i) {
+        for (size_t j = 0; j < n_outputs; ++j) {
+            float x = gradients[i * n_outputs + j];
+
+            float pred;
+            if (x >= MAX_EXP) {
+                pred = 1;
+            } else if (x <= -MAX_EXP) {
+                pred = 0;
+            } else {
+                pred = sigmoid_table(x);
+            }
+            gradients[i * n_outputs + j] = alpha * ((j == 0) - pred);
+        }
+    }
+
+    // input gradients: G x outputs, output gradients: G^T x inputs
+    kernels::gemm(false, false, n_inputs, d, n_outputs, 1, gradients.data(), n_outputs, out, ld,
+                  0, state.input_grads.data(), ld);
+    kernels::gemm(true, false, n_outputs, d, n_inputs, 1, gradients.data(), n_outputs, in, ld,
+                  0, state.output_grads.data(), ld);
+
+    for (size_t i = 0; i < n_inputs; ++i) {
+        ops.axpy(1, state.input_grads[i].data(), input_weights[inputs[i]].data(), d);
+    }
+    for (size_t j = 0; j < n_outputs; ++j) {
+        ops.axpy(1, state.output_grads[j].data(), output_weights[outputs[j]].data(), d);
+    }
 }
 
-vec MonolingualModel::hierarchicalUpdate(const HuffmanNode& node, const vec& hidden,
-        float alpha, bool update) {
-    int dimension = config->dimension;
-    vec temp(dimension, 0);
+void MonolingualModel::hierarchicalUpdate(int word, ConstVecRef hidden, VecRef error,
+                                          float alpha, ThreadState& state, bool update) {
+    const kernels::KernelTable& ops = *state.ops;
+    size_t d = hidden.size();
 
-    for (int j = 0; j < node.code.size(); ++j) {
-        int parent_index = node.parents[j];
-        float x = hidden.dot(output_weights_hs[parent_index]);
+    for (int j = code_offsets[word]; j < code_offsets[word + 1]; ++j) {
+        float* weights = output_weights_hs[huffman_parents[j]].data();
+        float x = ops.dot(hidden.data(), weights, d);
 
         if (x <= -MAX_EXP || x >= MAX_EXP) {
             continue;
         }
 
-        float pred = sigmoid(x);
-        float error = -alpha * (pred - node.code[j]);
+        float pred = sigmoid_table(x);
+        float g = -alpha * (pred - huffman_codes[j]);
 
-        temp += error * output_weights_hs[parent_index];
+        ops.axpy(g, weights, error.data(), d);
 
         if (update)
-            output_weights_hs[parent_index] += error * hidden;
+            ops.axpy(g, hidden.data(), weights, d);
     }
-
-    return temp;
 }
 
 vector<pair<string, int>> MonolingualModel::getWords() const {
     vector<pair<string, int>> res;
 
-    for (auto it = vocabulary.begin(); it != vocabulary.end(); ++it) {
-        res.push_back({it->second.word, it->second.count});
+    for (int index = 0; index < vocabulary.size(); ++index) {
+        res.push_back({vocabulary.word(index).str(), vocabulary.count(index)});
     }
 
     return res;
@@ -1,9 +1,58 @@
 #pragma once
 #include "utils.hpp"
 
+/**
+ * @brief Data owned by a training thread: its random generator, and scratch buffers for the hidden layer
+ * and the error, allocated once per thread, so that the training loop doesn't allocate any memory per word.
+ */
+struct ThreadState {
+    multivec::Random rng;
+    const kernels::KernelTable* ops; // vector kernels specialized for the dimension of the model
+
+    vec hidden;
+    vec error;
+
+    vector<int> words; // word indices of the current sentence
+    vector<int> trg_words; // word indices of the current target sentence (bilingual training)
+    vector<int> alignment;
+
+    // scratch buffers of negSamplingBatchUpdate
+    vector<int> batch_inputs; // word indices
+    vector<int> batch_outputs;
+    mat input_batch; // copies of the weights of the inputs and outputs, and their gradients
+    mat output_batch;
+    mat input_grads;
+    mat output_grads;
+    vector<float> batch_gradients;
+
+    int id; // thread id (slot in TrainingProgress)
+    long long word_count; // number of words processed by this thread
+    float alpha; // learning rate (updated by this thread from the global progress)
+    ThreadStats stats;
+
+    ThreadState(int dimension, const multivec::Random& rng, int id = 0) :
+            rng(rng), ops(&kernels::get(dimension)), hidden(dimension), error(dimension), id(id), word_count(0),
+            alpha(0) {}
+};
+
+/**
+ * @brief Training mode, known at compile time: the training functions are instantiated for each mode,
+ * and the right instance is selected once per call to train (see MonolingualModel::chunkTrainer), so that
+ * there is no test on the configuration for each word.
+ */
+template <bool SkipGram, bool HierarchicalSoftmax, bool NegativeSampling, bool Batch = false>
+struct TrainingMode {
+    static const bool skip_gram = SkipGram;
+    static const bool hierarchical_softmax = HierarchicalSoftmax;
+    static const bool negative_sampling = NegativeSampling;
+    static const bool batch = Batch; // skip-gram with negative sampling only (see Config::batch)
+};
+
 class MonolingualModel
 {
     friend class BilingualModel;
+    friend class SentenceReader;
+    friend struct ModelBenchmark; // micro-benchmarks of the training functions (main-bench.cpp)
     friend void save(ofstream& outfile, const MonolingualModel& model);
     friend void load(ifstream& infile, MonolingualModel& model);
 
@@ -20,45 +69,78 @@ private:
     // training file stats (properties of this training instance)
     long long training_words; // total number of words in training file (used for progress estimation)
     long long training_lines;
-    // training state
-    long long words_processed;
-    float alpha;
 
-    unordered_map<string, HuffmanNode> vocabulary;
-    vector<HuffmanNode*> unigram_table;
+    Vocabulary vocabulary;
+    UnigramSampler sampler; // negative sampling distribution
 
-    void addWordToVocab(const string& word);
-    void reduceVocab();
+    // flat copies of the vocabulary properties used during training (indexed by word index)
+    vector<int> word_counts;
+    vector<unsigned int> discard_thresholds; // word i is discarded if a random 32-bit integer is below discard_thresholds[i]
+    float subsampling_rate; // value of config->subsampling used to compute discard_thresholds
+    vector<int> code_offsets; // Huffman code of word i is in [code_offsets[i], code_offsets[i + 1])
+    vector<char> huffman_codes;
+    vector<int> huffman_parents;
+    SigmoidTable sigmoid_table;
+
+    TrainingStats stats; // statistics of the last call to train
+
+    void reduceVocab(const WordCounts& counts);
     void createBinaryTree();
-    void assignCodes(HuffmanNode* node, vector<int> code, vector<int> parents) const;
     void initUnigramTable();
+    void initWordTables();
+    void initSubsampling();
 
-    HuffmanNode* getRandomHuffmanNode(); // uses the unigram frequency table to sample a random node
+    int getRandomWord(multivec::Random& rng) const; // samples a random word index according to the unigram distribution
 
-    vector<HuffmanNode> getNodes(const string& sentence) const;
-    void subsample(vector<HuffmanNode>& node) const;
+    void getIndices(StringView sentence, vector<int>& indices) const; // OOV words get index -1
+    int subsample(vector<int>& indices, multivec::Random& rng, bool remove = false) const;
 
     void readVocab(const string& training_file);
-    void initNet();
-    void initSentWeights();
+    unsigned long long vocabHash() const;
 
-    void trainChunk(const string& training_file, const vector<long long>& chunks, int chunk_id);
+    // pre-tokenized corpora (see IdsHeader)
+    unique_ptr<MappedFile> openIds(const string& training_file);
+    bool writeIds(const string& training_file, const string& ids_file, const IdsHeader& header) const;
 
-    int trainSentence(const string& sent, int sent_id);
-    void trainWord(const vector<HuffmanNode>& nodes, int word_pos, int sent_id);
-    void trainWordCBOW(const vector<HuffmanNode>& nodes, int word_pos, int sent_id);
-    void trainWordSkipGram(const vector<HuffmanNode>& nodes, int word_pos, int sent_id);
-
-    vec hierarchicalUpdate(const HuffmanNode& node, const vec& hidden, float alpha, bool update = true);
-    vec negSamplingUpdate(const HuffmanNode& node, const vec& hidden, float alpha, bool update = true);
-
-    vector<long long> chunkify(const string& filename, int n_chunks);
+    void initNet(int stream = multivec::WEIGHTS_STREAM); // `stream`: random stream used to initialize the weights
+    void initSentWeights();
+    void initSigmoidTable();
+
+    typedef void (MonolingualModel::*ChunkTrainer)(const MappedFile&, bool, const Chunk&, ThreadState&,
+                                                   TrainingProgress&);
+    ChunkTrainer chunkTrainer() const; // trainChunk instance for the current configuration
+
+    void trainThread(const MappedFile& corpus, bool pretokenized, const vector<Chunk>& chunks, int thread_id,
+                     atomic<long long>& next_job, TrainingProgress& progress, ChunkTrainer train_chunk);
+    template <class Mode>
+    void trainChunk(const MappedFile& corpus, bool pretokenized, const Chunk& chunk, ThreadState& state,
+                    TrainingProgress& progress);
+
+    template <class Mode>
+    int trainSentence(vector<int>& words, int sent_id, ThreadState& state);
+    template <class Mode>
+    void trainWordCBOW(const vector<int>& words, int word_pos, int sent_id, ThreadState& state);
+    template <class Mode>
+    void trainWordSkipGram(const vector<int>& words, int word_pos, int sent_id, ThreadState& state);
+
+    // these functions add the gradient w.r.t. the hidden layer to `error`
+    void hierarchicalUpdate(int word, ConstVecRef hidden, VecRef error, float alpha, ThreadState& state,
+                            bool update = true);
+    void negSamplingUpdate(int word, ConstVecRef hidden, VecRef error, float alpha, ThreadState& state,
+                           bool update = true);
+    // `state.batch_inputs` (rows of `input_weights`) all predict `word`, with the same negative samples
+    void negSamplingBatchUpdate(int word, mat& input_weights, float alpha, ThreadState& state);
+
+    vector<Chunk> chunkify(const MappedFile& file, bool pretokenized, const string& filename, int n_chunks);
     vec wordVec(int index, int policy) const;
+    int wordVecSize(int policy) const; // size of the vectors returned by wordVec
+    vector<float> similarities(const vec& v, int policy) const; // cosine similarity of `v` with all the words
+    vector<pair<string, float>> closest(const vec& v, int n, int policy, int skip) const;
 
 public:
-    MonolingualModel(Config* config) : config(config) {}  // prefer this constructor
+    MonolingualModel(Config* config) : config(config), subsampling_rate(-1) {}  // prefer this constructor
 
-    vec wordVec(const string& word, int policy = 0) const; // word embedding
+    vec wordVec(StringView word, int policy = 0) const; // word embedding
     vec sentVec(const string& sentence); // paragraph vector (Le & Mikolov), TODO: custom alpha and iterations
     void sentVec(istream& infile); // compute paragraph vector for all lines in a stream
 
@@ -72,8 +154,8 @@ public:
 
     void normalizeWeights(); // normalize all weights between 0 and 1
 
-    float similarity(const string& word1, const string& word2, int policy = 0) const; // cosine similarity
-    float distance(const string& word1, const string& word2, int policy = 0) const; // 1 - cosine similarity
+    float similarity(StringView word1, StringView word2, int policy = 0) const; // cosine similarity
+    float distance(StringView word1, StringView word2, int policy = 0) const; // 1 - cosine similarity
     float similarityNgrams(const string& seq1, const string& seq2, int policy = 0) const; // similarity between two sequences of same size
     float similaritySentence(const string& seq1, const string& seq2, int policy = 0) const; // similarity between two variable-size sequences
     // similarity between two variable-size sequences taking into account part-of-speech tags and inverse document frequencies of terms in the sequences
@@ -90,7 +172,38 @@ public:
     vector<pair<string, float>> closest(const string& word, const vector<string>& words, int policy = 0) const;
     vector<pair<string, float>> closest(const vec& v, int n = 10, int policy = 0) const;
 
-    vector<pair<string, int>> getWords() const; // get words with their counts
+    vector<pair<string, int>> getWords() const; // get words with their counts (in order of index)
+    const TrainingStats& getStats() const { return stats; }
     
     void analogicalReasoning(const string& filename, int max_voc = 0, int policy = 0) const;
 };
+
+/**
+ * @brief Read the sentences of a chunk of a training corpus as word indices (-1 for OOV words),
+ * either from the text file, or from its pre-tokenized version.
+ */
+class SentenceReader {
+    const MonolingualModel& model;
+    bool pretokenized;
+    LineReader lines;
+    IdReader ids;
+
+public:
+    SentenceReader(const MonolingualModel& model, const MappedFile& corpus, bool pretokenized,
+                   size_t begin, size_t end = static_cast<size_t>(-1)) :
+            model(model), pretokenized(pretokenized), lines(corpus, begin, end), ids(corpus, begin, end)
+    {}
+
+    bool next(vector<int>& words) {
+        if (pretokenized) {
+            return ids.next(words);
+        }
+
+        StringView line;
+        if (!lines.next(line)) {
+            return false;
+        }
+        model.getIndices(line, words);
+        return true;
+    }
+};
@@ -0,0 +1,88 @@
+#include "sampler.hpp"
+#include <cmath>
+#include <stdexcept>
+
+UnigramSampler::UnigramSampler(const std::vector<int>& counts, const std::string& method, double power) : _name(method) {
+    if (method == "table") {
+        _method = TABLE;
+    } else if (method == "alias") {
+        _method = ALIAS;
+    } else if (method == "cdf") {
+        _method = CDF;
+    } else {
+        throw std::runtime_error("unknown sampling method " + method);
+    }
+
+    size_t n = counts.size();
+    if (n == 0) {
+        return;
+    }
+
+    std::vector<double> weights(n);
+    double total = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        weights[i] = pow(counts[i], power); // weird word2vec tweak ('normal' value would be 1.0)
+        total += weights[i];
+    }
+
+    if (_method == TABLE) {
+        // same as word2vec: word i fills the entries whose position falls in its share of the cumulative distribution
+        size_t table_size = std::min(static_cast<size_t>(UNIGRAM_TABLE_SIZE), n * UNIGRAM_TABLE_RATIO);
+        table.resize(table_size);
+
+        size_t i = 0;
+        double cumulative = weights[0] / total;
+        for (size_t k = 0; k < table_size; ++k) {
+            table[k] = static_cast<int>(i);
+            if (static_cast<double>(k) / table_size > cumulative && i < n - 1) {
+                cumulative += weights[++i] / total;
+            }
+        }
+    } else if (_method == ALIAS) {
+        // Vose's algorithm
+        alias_table.resize(n);
+        std::vector<double> prob(n);
+        std::vector<int> small, large;
+
+        for (size_t i = 0; i < n; ++i) {
+            prob[i] = weights[i] * n / total;
+            (prob[i] < 1.0 ? small : large).push_back(static_cast<int>(i));
+        }
+
+        while (!small.empty() && !large.empty()) {
+            int s = small.back();
+            int l = large.back();
+            small.pop_back();
+
+            alias_table[s].prob = static_cast<float>(prob[s]);
+            alias_table[s].alias = l;
+
+            prob[l] = (prob[l] + prob[s]) - 1.0;
+            if (prob[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        // remaining entries have a probability of 1 (up to rounding errors)
+        for (auto it = large.begin(); it != large.end(); ++it) {
+            alias_table[*it].prob = 1.0f;
+            alias_table[*it].alias = *it;
+        }
+        for (auto it = small.begin(); it != small.end(); ++it) {
+            alias_table[*it].prob = 1.0f;
+            alias_table[*it].alias = *it;
+        }
+    } else {
+        cdf.resize(n);
+        double cumulative = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            cumulative += weights[i] / total;
+            cdf[i] = cumulative;
+        }
+    }
+}
+
+size_t UnigramSampler::memory() const {
+    return table.size() * sizeof(int) + alias_table.size() * sizeof(AliasEntry) + cdf.size() * sizeof(double);
+}
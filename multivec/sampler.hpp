@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <algorithm>
+
+const int UNIGRAM_TABLE_SIZE = 1e8; // maximum size of the frequency table
+const int UNIGRAM_TABLE_RATIO = 100; // size of the frequency table per vocabulary word
+
+/**
+ * @brief Draws random words according to their unigram frequency raised to the power 0.75,
+ * which is the noise distribution of word2vec's negative sampling. Three methods are available:
+ *
+ * "table": table of word indices, where each word appears a number of times proportional to its
+ * probability (as in word2vec). Its size is proportional to the vocabulary size, with a maximum of
+ * UNIGRAM_TABLE_SIZE entries.
+ * "alias": alias method (Walker, Vose), O(V) memory and O(1) draws, exact distribution.
+ * "cdf": binary search in the cumulative distribution, O(V) memory and O(log V) draws.
+ */
+class UnigramSampler {
+    enum Method { TABLE, ALIAS, CDF };
+
+    struct AliasEntry {
+        float prob; // probability of keeping this entry's word
+        int alias; // word to return otherwise
+    };
+
+    Method _method;
+    std::string _name;
+
+    std::vector<int> table;
+    std::vector<AliasEntry> alias_table;
+    std::vector<double> cdf;
+
+public:
+    UnigramSampler() : _method(ALIAS) {}
+    UnigramSampler(const std::vector<int>& counts, const std::string& method, double power = 0.75);
+
+    /**
+     * @brief Return a random word index. `random` is a random number, whose 48 lower bits are used.
+     */
+    int sample(unsigned long long random) const {
+        switch (_method) {
+            case TABLE:
+                return table[random % table.size()];
+            case ALIAS: {
+                size_t i = (random >> 16) % alias_table.size();
+                float u = (random & 0xFFFF) / 65536.0f;
+                return u < alias_table[i].prob ? static_cast<int>(i) : alias_table[i].alias;
+            }
+            default: {
+                double u = (random & 0xFFFFFFFFFFFFULL) / static_cast<double>(1ULL << 48);
+                size_t i = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+                return static_cast<int>(std::min(i, cdf.size() - 1));
+            }
+        }
+    }
+
+    const std::string& method() const { return _name; }
+    bool empty() const { return table.empty() && alias_table.empty() && cdf.empty(); }
+    size_t memory() const; // size in bytes
+};
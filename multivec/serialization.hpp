@@ -63,6 +63,38 @@ inline void load(ifstream& infile, vec& v) {
     }
 }
 
+// same format as a vector of vec (number of rows, then size and values of each row)
+inline void save(ofstream& outfile, const mat& m) {
+    save(outfile, m.rows());
+    for (size_t i = 0; i < m.rows(); ++i) {
+        save(outfile, m.cols());
+        outfile.write(reinterpret_cast<const char*>(m[i].data()), sizeof(float) * m.cols());
+    }
+}
+
+inline void load(ifstream& infile, mat& m) {
+    size_t rows = 0, cols = 0;
+    load(infile, rows);
+
+    for (size_t i = 0; i < rows; ++i) {
+        size_t size = 0;
+        load(infile, size);
+
+        if (i == 0) {
+            cols = size;
+            m = mat(rows, cols);
+        } else if (size != cols) {
+            throw runtime_error("inconsistent row size in weight matrix");
+        }
+
+        infile.read(reinterpret_cast<char*>(m[i].data()), sizeof(float) * cols);
+    }
+
+    if (rows == 0) {
+        m = mat();
+    }
+}
+
 inline void save(ofstream& outfile, const Config& cfg) {
     save(outfile, cfg.learning_rate);
     save(outfile, cfg.dimension);
@@ -103,30 +135,21 @@ inline void load(ifstream& infile, BilingualConfig& cfg) {
     load(infile, cfg.beta);
 }
 
-inline void save(ofstream& outfile, const HuffmanNode& node) {
-    save(outfile, node.index);
-    save(outfile, node.count);
-    save(outfile, node.word);
-    save(outfile, node.code);
-    save(outfile, node.parents);
-}
-
-inline void load(ifstream& infile, HuffmanNode& node) {
-    load(infile, node.index);
-    load(infile, node.count);
-    load(infile, node.word);
-    load(infile, node.code);
-    load(infile, node.parents);
-}
-
 inline void save(ofstream& outfile, const MonolingualModel& model) {
     save(outfile, *model.config);
-    save(outfile, model.vocabulary.size());
-
-    // transform into map to save in lexicographical order (for consistency)
-    map<string, HuffmanNode> voc_ordered(model.vocabulary.begin(), model.vocabulary.end());
-    for (auto it = voc_ordered.begin(); it != voc_ordered.end(); ++it) {
-        save(outfile, it->second);
+    save(outfile, static_cast<size_t>(model.vocabulary.size()));
+
+    // save in order of index (for consistency), the indices are also saved
+    for (int index = 0; index < model.vocabulary.size(); ++index) {
+        save(outfile, index);
+        save(outfile, model.vocabulary.count(index));
+        save(outfile, model.vocabulary.word(index).str());
+
+        // Huffman code and parents of this word
+        auto begin = model.code_offsets[index];
+        auto end = model.code_offsets[index + 1];
+        save(outfile, vector<int>(model.huffman_codes.begin() + begin, model.huffman_codes.begin() + end));
+        save(outfile, vector<int>(model.huffman_parents.begin() + begin, model.huffman_parents.begin() + end));
     }
 
     save(outfile, model.input_weights);
@@ -140,12 +163,42 @@ inline void load(ifstream& infile, MonolingualModel& model) {
 
     size_t vocabulary_size = 0;
     load(infile, vocabulary_size);
+
+    // older models are saved in the (unspecified) iteration order of an unordered_map: each word is stored with its
+    // index, and the words are added to the vocabulary once they are all read, in the order of their indices
+    vector<string> words(vocabulary_size);
+    vector<int> counts(vocabulary_size, -1);
+    vector<vector<int>> codes(vocabulary_size), parents(vocabulary_size);
+    for (size_t i = 0; i < vocabulary_size; ++i) {
+        int index = 0, count = 0;
+        load(infile, index);
+        load(infile, count);
+
+        if (index < 0 || index >= vocabulary_size || counts[index] != -1) {
+            throw runtime_error("invalid word index in model file");
+        }
+        counts[index] = count;
+        load(infile, words[index]);
+        load(infile, codes[index]);
+        load(infile, parents[index]);
+    }
+
     model.vocabulary.clear();
+    model.vocabulary.reserve(vocabulary_size);
+    for (size_t i = 0; i < vocabulary_size; ++i) {
+        model.vocabulary.add(words[i], counts[i]);
+    }
 
+    // flat Huffman tables, in order of word index
+    model.code_offsets.assign(vocabulary_size + 1, 0);
+    for (size_t i = 0; i < vocabulary_size; ++i) {
+        model.code_offsets[i + 1] = model.code_offsets[i] + static_cast<int>(codes[i].size());
+    }
+    model.huffman_codes.clear();
+    model.huffman_parents.clear();
     for (size_t i = 0; i < vocabulary_size; ++i) {
-        HuffmanNode node(0, ""); // empty constructor creates UNK node
-        load(infile, node);
-        model.vocabulary.insert({node.word, node});
+        model.huffman_codes.insert(model.huffman_codes.end(), codes[i].begin(), codes[i].end());
+        model.huffman_parents.insert(model.huffman_parents.end(), parents[i].begin(), parents[i].end());
     }
 
     load(infile, model.input_weights);
@@ -0,0 +1,99 @@
+#include "stats.hpp"
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <sys/resource.h>
+
+using namespace std;
+
+void TrainingStats::clear() {
+    phases.clear();
+    epochs.clear();
+    threads.clear();
+}
+
+void TrainingStats::addPhase(const string& name, double seconds) {
+    for (auto it = phases.begin(); it != phases.end(); ++it) {
+        if (it->first == name) {
+            it->second += seconds;
+            return;
+        }
+    }
+    phases.push_back(make_pair(name, seconds));
+}
+
+double TrainingStats::phase(const string& name) const {
+    for (auto it = phases.begin(); it != phases.end(); ++it) {
+        if (it->first == name) {
+            return it->second;
+        }
+    }
+    return 0;
+}
+
+static double perSecond(double count, double seconds) {
+    return seconds > 0 ? count / seconds : 0;
+}
+
+void TrainingStats::save(const string& filename) const {
+    ofstream outfile(filename);
+    if (!outfile.is_open()) {
+        throw runtime_error("couldn't open file " + filename);
+    }
+
+    ThreadStats total;
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        total.words += it->words;
+        total.io_time += it->io_time;
+        total.compute_time += it->compute_time;
+        total.negative_samples += it->negative_samples;
+        total.rejected_samples += it->rejected_samples;
+    }
+    double train_time = phase("train");
+
+    outfile << setprecision(6) << fixed;
+    outfile << "{" << endl;
+    outfile << "  \"threads\": " << threads.size() << "," << endl;
+    outfile << "  \"words\": " << total.words << "," << endl;
+    outfile << "  \"words_per_sec\": " << perSecond(total.words, train_time) << "," << endl;
+
+    outfile << "  \"phases\": {";
+    for (auto it = phases.begin(); it != phases.end(); ++it) {
+        outfile << (it == phases.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+    }
+    outfile << "}," << endl;
+
+    outfile << "  \"epochs\": [";
+    for (auto it = epochs.begin(); it != epochs.end(); ++it) {
+        outfile << (it == epochs.begin() ? "" : ", ") << *it;
+    }
+    outfile << "]," << endl;
+
+    outfile << "  \"io_time\": " << total.io_time << "," << endl;
+    outfile << "  \"compute_time\": " << total.compute_time << "," << endl;
+    outfile << "  \"negative_samples\": " << total.negative_samples << "," << endl;
+    outfile << "  \"rejected_samples\": " << total.rejected_samples << "," << endl;
+    outfile << "  \"peak_rss\": " << peakMemory() << "," << endl;
+
+    // words per second of each thread, w.r.t. the time it spent reading and training
+    outfile << "  \"per_thread\": [" << endl;
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        outfile << "    {\"words\": " << it->words
+                << ", \"words_per_sec\": " << perSecond(it->words, it->io_time + it->compute_time)
+                << ", \"io_time\": " << it->io_time
+                << ", \"compute_time\": " << it->compute_time
+                << ", \"negative_samples\": " << it->negative_samples
+                << ", \"rejected_samples\": " << it->rejected_samples << "}"
+                << (it + 1 == threads.end() ? "" : ",") << endl;
+    }
+    outfile << "  ]" << endl;
+    outfile << "}" << endl;
+}
+
+long long peakMemory() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return static_cast<long long>(usage.ru_maxrss) * 1024; // in kilobytes on Linux
+}
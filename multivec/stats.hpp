@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+
+/**
+ * @brief Wall-clock stopwatch, used to measure the training phases.
+ */
+class Timer {
+    std::chrono::high_resolution_clock::time_point start;
+
+public:
+    Timer() : start(std::chrono::high_resolution_clock::now()) {}
+
+    void reset() { start = std::chrono::high_resolution_clock::now(); }
+
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+};
+
+/**
+ * @brief Counters of a training thread. Each thread updates its own copy, which is
+ * copied into TrainingStats when the thread is done.
+ */
+struct ThreadStats {
+    long long words; // number of in-vocabulary words read, before subsampling (all epochs, see subsample)
+    double io_time; // time spent reading sentences, in seconds
+    double compute_time; // time spent training on these sentences, in seconds
+    long long negative_samples; // number of negative samples drawn
+    long long rejected_samples; // negative samples equal to the positive word (skipped)
+
+    ThreadStats() : words(0), io_time(0), compute_time(0), negative_samples(0), rejected_samples(0) {}
+};
+
+/**
+ * @brief Statistics of a training run, saved as JSON with the --stats option, to track
+ * throughput regressions without a profiler.
+ */
+struct TrainingStats {
+    std::vector<std::pair<std::string, double>> phases; // duration of each phase (vocab, chunkify, init, train, save)
+    std::vector<double> epochs; // duration of each epoch, from its first block to its last (epochs overlap between threads)
+    std::vector<ThreadStats> threads;
+
+    void clear();
+    void addPhase(const std::string& name, double seconds); // adds to the existing phase of the same name
+    double phase(const std::string& name) const;
+
+    void save(const std::string& filename) const;
+};
+
+long long peakMemory(); // peak resident set size of the process, in bytes (0 if unknown)
@@ -9,25 +9,65 @@
 #include <fstream>
 #include <sstream>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <assert.h>
 #include <iomanip> // setprecision, setw, left
 #include <chrono>
+#include <memory>
 #include <iterator>
 #include "vec.hpp"
+#include "sampler.hpp"
+#include "corpus.hpp"
+#include "vocabulary.hpp"
+#include "stats.hpp"
 
 using namespace std;
 using namespace std::chrono;
 
 const float MAX_EXP = 6;
-const int UNIGRAM_TABLE_SIZE = 1e8; // size of the frequency table
 
 typedef Vec vec;
-typedef vector<vec> mat;
+typedef Mat mat;
 
 inline float sigmoid(float x) {
     return 1 / (1 + exp(-x));
 }
 
+/**
+ * @brief Precomputed values of the sigmoid function on [-MAX_EXP, MAX_EXP] (same trick as
+ * word2vec's expTable). Values outside of this interval are clamped. With a size of 0,
+ * the exact value is computed with exp (slower, useful for validation).
+ */
+class SigmoidTable {
+    vector<float> table;
+    float scale; // number of table entries per unit
+
+public:
+    SigmoidTable(int size = 0) { init(size); }
+
+    void init(int size) {
+        table.resize(max(size, 0));
+        scale = table.size() / (2 * MAX_EXP);
+
+        for (size_t i = 0; i < table.size(); ++i) {
+            table[i] = sigmoid(-MAX_EXP + (i + 0.5f) / scale); // value at the center of each bin
+        }
+    }
+
+    int size() const { return static_cast<int>(table.size()); }
+
+    float operator()(float x) const {
+        if (table.empty()) {
+            return sigmoid(x);
+        }
+
+        int i = static_cast<int>((x + MAX_EXP) * scale);
+        return table[min(max(i, 0), size() - 1)];
+    }
+};
+
 inline float cosineSimilarity(const vec &v1, const vec &v2) {
     return v1.dot(v2) / (v1.norm() * v2.norm());
 }
@@ -37,18 +77,6 @@ inline string lower(string s) {
     return s;
 }
 
-inline vector<string> split(const string& sequence) {
-    vector<string> words;
-    istringstream iss(sequence);
-    string word;
-
-    while (iss >> word) {
-        words.push_back(word);
-    }
-
-    return words;
-}
-
 inline void check_is_open(ifstream& infile, const string& filename) {
     if (!infile.is_open()) {
         throw runtime_error("couldn't open file " + filename);
@@ -67,64 +95,197 @@ inline void check_is_non_empty(ifstream& infile, const string& filename) {
     }
 }
 
+inline void check_is_non_empty(const MappedFile& file, const string& filename) {
+    if (file.empty()) {
+        throw runtime_error("training file " + filename + " is empty");
+    }
+}
+
 namespace multivec {
     /**
-     * @brief Custom random generator. std::rand is thread-safe but very slow with multiple threads.
-     * https://en.wikipedia.org/wiki/Linear_congruential_generator
-     *
-     * @return next random number
+     * @brief Custom random generator (xorshift64*, https://en.wikipedia.org/wiki/Xorshift).
+     * std::rand is thread-safe but very slow with multiple threads, so each training thread
+     * owns its own generator. The state is initialized from a seed and a stream number (e.g., thread id)
+     * with splitmix64, so that different streams are independent.
      */
-    inline unsigned long long rand() {
-        static unsigned long long next_random(time(NULL)); // in C++11 the thread_local keyword would solve the thread safety problem.
-        next_random = next_random * static_cast<unsigned long long>(25214903917) + 11; // unsafe, but we don't care
-        return next_random >> 16; // with this generator, the most significant bits are bits 47...16
-    }
+    class Random {
+        unsigned long long state;
 
-    inline float randf() {
-        return  (multivec::rand() & 0xFFFF) / 65536.0f;
-    }
+        static unsigned long long splitmix64(unsigned long long x) {
+            x += 0x9E3779B97F4A7C15ULL;
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+            return x ^ (x >> 31);
+        }
+
+    public:
+        Random(unsigned long long seed = 1, unsigned long long stream = 0) {
+            state = splitmix64(seed ^ splitmix64(stream));
+            if (state == 0) state = 1; // xorshift state must be non-zero
+        }
+
+        /**
+         * @return next random number (64 bits)
+         */
+        unsigned long long operator()() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 0x2545F4914F6CDD1DULL;
+        }
+
+        /**
+         * @return random float in [0, 1)
+         */
+        float randf() {
+            return (operator()() >> 40) / 16777216.0f;
+        }
+    };
+
+    // Random streams: each use of the generators has its own streams, so that no two of them draw the same numbers.
+    enum RandomStream {
+        WEIGHTS_STREAM = 0,       // input weights (initNet), source model of a BilingualModel
+        TRG_WEIGHTS_STREAM = 1,   // input weights of the target model of a BilingualModel
+        SENT_WEIGHTS_STREAM = 2,  // sentence weights (initSentWeights)
+        INFERENCE_STREAM = 3,     // sentVec
+        TRAINING_STREAM = 4       // training thread i uses stream TRAINING_STREAM + i
+    };
 }
 
 /**
- * @brief Node of a Huffman binary tree, used for the hierarchical softmax algorithm.
+ * @brief Training progress, shared by the training threads. Each thread publishes its own word count
+ * in a separate slot (one cache line per thread) with relaxed atomic stores, so the threads never write
+ * to the same memory location. The learning rate is a function of the total count, which each thread
+ * recomputes from time to time for its own use. When verbose, a single reporter thread prints the progress
+ * at a fixed interval. The start and end of each epoch are recorded when its first block starts and its last
+ * block is done (see TrainingStats).
  */
-struct HuffmanNode {
-    static const HuffmanNode UNK; // node for out-of-vocabulary words
+class TrainingProgress {
+    struct Counter {
+        atomic<long long> words;
+        char padding[64 - sizeof(atomic<long long>)]; // no false sharing between threads
+    };
+
+    // one cache line per counter: new doesn't guarantee the alignment, so the array is allocated like a Mat
+    struct FreeCounters {
+        void operator()(Counter* p) const { free(p); }
+    };
+
+    static Counter* allocateCounters(int n) {
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, sizeof(Counter), n * sizeof(Counter)) != 0) {
+            throw std::bad_alloc();
+        }
+        Counter* counters = static_cast<Counter*>(ptr);
+        for (int i = 0; i < n; ++i) {
+            new (&counters[i].words) atomic<long long>(0);
+        }
+        return counters;
+    }
+
+    unique_ptr<Counter[], FreeCounters> counters;
+    int n_threads;
+    long long total_words; // number of words to process (all epochs)
+    float starting_alpha;
+
+    int n_blocks;
+    unique_ptr<atomic<int>[]> remaining_blocks; // number of blocks left in each epoch
+    vector<double> epoch_starts; // written by the thread that starts the epoch, read after training
+    vector<double> epoch_ends; // written by the thread that finishes the epoch, read after training
+    Timer timer;
+
+    bool done;
+    mutex reporter_mutex;
+    condition_variable reporter_cv;
+    thread reporter;
+
+public:
+    enum { REPORT_INTERVAL = 100 }; // in milliseconds (an enumerator: passed by reference, it needs no definition)
 
-    string word;
+    TrainingProgress(int n_threads, int n_epochs, int n_blocks, long long total_words, float starting_alpha) :
+            counters(allocateCounters(n_threads)), n_threads(n_threads), total_words(max(total_words, 1LL)),
+            starting_alpha(starting_alpha), n_blocks(n_blocks), remaining_blocks(new atomic<int>[n_epochs]),
+            epoch_starts(n_epochs), epoch_ends(n_epochs), done(false) {
+        for (int i = 0; i < n_epochs; ++i) {
+            remaining_blocks[i].store(n_blocks);
+        }
+    }
 
-    vector<int> code; // Huffman code of this node: path from root to leaf (0 for left, 1 for right)
-    vector<int> parents; // indices of the parent nodes
+    ~TrainingProgress() { stopReporter(); }
 
-    HuffmanNode* left; // used for constructing the tree, useless afterwards
-    HuffmanNode* right;
+    long long words() const {
+        long long words = 0;
+        for (int i = 0; i < n_threads; ++i) {
+            words += counters[i].words.load(memory_order_relaxed);
+        }
+        return words;
+    }
 
-    int index;
-    int count;
+    float alpha(long long words) const { // linearly decreasing learning rate
+        float alpha = starting_alpha * (1 - static_cast<float>(words) / total_words);
+        return max(alpha, starting_alpha * 0.0001f);
+    }
 
-    bool is_leaf;
-    bool is_unk;
+    float alpha() const { return alpha(words()); }
 
-    HuffmanNode() : index(-1), is_unk(true) {}
+    /**
+     * @brief Publish the number of words processed so far by thread `thread_id`
+     * @return current learning rate
+     */
+    float update(int thread_id, long long words) {
+        counters[thread_id].words.store(words, memory_order_relaxed);
+        return alpha();
+    }
 
-    HuffmanNode(int index, const string& word) :
-            word(word), index(index), count(1), is_leaf(true), is_unk(false)
-    {}
+    // the jobs are claimed in increasing order, so the first block of an epoch is the first one to start
+    void blockStarted(long long job) { // job: block index + epoch * n_blocks
+        if (job % n_blocks == 0) {
+            epoch_starts[job / n_blocks] = timer.seconds();
+        }
+    }
 
-    HuffmanNode(int index, HuffmanNode* left, HuffmanNode* right) :
-            left(left), right(right), index(index), count(left->count + right->count), is_leaf(false), is_unk(false)
-    {}
+    void blockDone(long long job) {
+        int epoch = static_cast<int>(job / n_blocks);
+        if (--remaining_blocks[epoch] == 0) {
+            epoch_ends[epoch] = timer.seconds();
+        }
+    }
 
-    bool operator==(const HuffmanNode& node) const {
-        return index == node.index;
+    // time from the start of the first block of each epoch to the end of its last block (the epochs may overlap)
+    vector<double> epochDurations() const {
+        vector<double> durations(epoch_ends.size());
+        for (size_t i = 0; i < epoch_ends.size(); ++i) {
+            durations[i] = epoch_ends[i] - epoch_starts[i];
+        }
+        return durations;
+    }
+
+    void print() const {
+        long long words = this->words();
+        printf("\rAlpha: %f  Progress: %.2f%%", alpha(words), 100.0 * words / total_words);
+        fflush(stdout);
     }
 
-    bool operator!=(const HuffmanNode& node) const {
-        return !(operator==(node));
+    void startReporter() {
+        reporter = thread([this]() {
+            unique_lock<mutex> lock(reporter_mutex);
+            while (!done) {
+                reporter_cv.wait_for(lock, milliseconds(REPORT_INTERVAL));
+                print();
+            }
+        });
     }
 
-    static bool comp(const HuffmanNode* v1, const HuffmanNode* v2) {
-        return (v1->count) > (v2->count);
+    void stopReporter() {
+        if (!reporter.joinable()) {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(reporter_mutex);
+            done = true;
+        }
+        reporter_cv.notify_one();
+        reporter.join();
     }
 };
 
@@ -141,6 +302,12 @@ struct Config {
     bool skip_gram; // set to true to use skip-gram model instead of CBOW
     int negative; // number of negative samples used for the negative sampling training algorithm
     bool sent_vector; // includes sentence vectors in the training
+    int sigmoid_table_size; // resolution of the sigmoid lookup table (0 for exact computation)
+    string sampler; // negative sampling method ("table", "alias" or "cdf", see UnigramSampler)
+    unsigned long long seed; // seed of the random generators (each thread uses this seed and its thread id)
+    bool train_ids; // train from a pre-tokenized version of the training files (see MonolingualModel::openIds)
+    int vocab_memory; // approximate memory limit (in MB) for counting the vocabulary, 0 for no limit (see countWords)
+    bool batch; // skip-gram with negative sampling: mini-batch update of each context (see negSamplingBatchUpdate)
 
     Config() :
         learning_rate(0.05),
@@ -154,7 +321,13 @@ struct Config {
         hierarchical_softmax(false),
         skip_gram(false),
         negative(5),
-        sent_vector(false)
+        sent_vector(false),
+        sigmoid_table_size(1000), // not serialized
+        sampler("alias"), // not serialized
+        seed(1), // not serialized
+        train_ids(false), // not serialized
+        vocab_memory(0), // not serialized
+        batch(false) // not serialized
         {}
 
     virtual void print() const {
@@ -170,6 +343,12 @@ struct Config {
         std::cout << "HS:          " << hierarchical_softmax << std::endl;
         std::cout << "negative:    " << negative << std::endl;
         std::cout << "sent vector: " << sent_vector << std::endl;
+        std::cout << "sigmoid table: " << sigmoid_table_size << std::endl;
+        std::cout << "sampler:     " << sampler << std::endl;
+        std::cout << "seed:        " << seed << std::endl;
+        std::cout << "train ids:   " << train_ids << std::endl;
+        std::cout << "vocab memory: " << vocab_memory << std::endl;
+        std::cout << "batch:       " << batch << std::endl;
     }
 };
 
@@ -4,6 +4,11 @@
 #include <sstream>
 #include <algorithm>
 #include <iterator>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <new>
+#include "kernels.hpp"
 
 /**
  * Small linear algebra library that supports basic operations between vectors: difference, addition or dot product of 
@@ -14,6 +19,12 @@
  * Vector operations like: (u + alpha * v) use a single for loop, while
  * naive operator overloading would use two loops.
  * 
+ * The most common operations between two vectors (dot product, v += u, v += alpha * u, etc.)
+ * bypass the expression templates and call the SIMD kernels of kernels.hpp.
+ * 
+ * Weight matrices are stored in a contiguous Mat, whose rows are views (VecRef) that can be used
+ * like any other vector.
+ * 
  * Examples:
  * Vec v1({2,0,2});
  * v1 /= 2;
@@ -22,7 +33,8 @@
  * float u = v1.dot(v2);
  * std::cout << v << std::endl;    #[1, 0, 0.5]
  * 
- * TODO: integrate with BLAS
+ * Products of matrices (e.g., similarities with all the rows of a Mat) use kernels::gemv and kernels::gemm,
+ * which call BLAS when compiled with MULTIVEC_BLAS.
  */
 
 template <typename E>
@@ -40,7 +52,103 @@ public:
     operator E const&() const { return static_cast<const E&>(*this); }
 };
 
-class Vec : public VecExpression<Vec> {
+template <typename E>
+class VecScaled;
+
+/**
+ * Operations shared by all the vector types that own or reference a contiguous array of floats (Vec and VecView).
+ * Operations with another dense vector call the SIMD kernels, while operations with arbitrary expressions
+ * use a simple loop.
+ */
+template <typename D>
+class DenseVec : public VecExpression<D> {
+    D& self() { return static_cast<D&>(*this); }
+    D const& self() const { return static_cast<D const&>(*this); }
+
+    // the kernels read and write `size()` floats: checked in all builds, since the operands may come from user code
+    void checkSize(size_t size) const {
+        if (size != self().size()) {
+            throw std::runtime_error("wrong vector size");
+        }
+    }
+
+    template <typename D2>
+    void addScaled(float alpha, DenseVec<D2> const& v) {
+        checkSize(v.size());
+        kernels::axpy(alpha, static_cast<D2 const&>(v).data(), self().data(), v.size());
+    }
+
+    template <typename E>
+    void addScaled(float alpha, VecExpression<E> const& vec) {
+        E const& v = vec;
+        checkSize(v.size());
+        for (size_t i = 0; i != v.size(); ++i) {
+            self()[i] += alpha * v[i];
+        }
+    }
+
+public:
+    template <typename E>
+    float dot(VecExpression<E> const& vec) const {
+        E const& v = vec;
+        checkSize(v.size());
+        float x = 0;
+        for (size_t i = 0; i != v.size(); ++i) {
+            x += self()[i] * v[i];
+        }
+        return x;
+    }
+
+    template <typename D2>
+    float dot(DenseVec<D2> const& v) const {
+        checkSize(v.size());
+        return kernels::dot(self().data(), static_cast<D2 const&>(v).data(), v.size());
+    }
+
+    template <typename E>
+    void operator+=(VecExpression<E> const& v) {
+        addScaled(1.0f, v);
+    }
+
+    template <typename E>
+    void operator+=(VecScaled<E> const& v) {
+        addScaled(v.scale(), v.operand());
+    }
+
+    template <typename E>
+    void operator-=(VecExpression<E> const& v) {
+        addScaled(-1.0f, v);
+    }
+
+    // dense operands: more specific than VecExpression, so that they call the kernels
+    template <typename D2>
+    void operator+=(DenseVec<D2> const& v) {
+        addScaled(1.0f, v);
+    }
+
+    template <typename D2>
+    void operator-=(DenseVec<D2> const& v) {
+        addScaled(-1.0f, v);
+    }
+
+    void fill(float value) {
+        std::fill(self().data(), self().data() + self().size(), value);
+    }
+
+    void operator*=(float alpha) {
+        kernels::scal(alpha, self().data(), self().size());
+    }
+
+    void operator/=(float alpha) {
+        kernels::scal(1 / alpha, self().data(), self().size());
+    }
+
+    float norm() const {
+        return std::sqrt(dot(*this));
+    }
+};
+
+class Vec : public DenseVec<Vec> {
     container_type _data;
 public:
     reference operator[](size_type i) { return _data[i]; }
@@ -79,48 +187,128 @@ public:
         }
     }
 
+    const value_type* data() const { return _data.data(); }
+    value_type* data() { return _data.data(); }
+};
+
+/**
+ * Non-owning view on a contiguous array of floats (e.g., a row of a Mat). A view can be used in vector
+ * expressions like a Vec. Assigning to a view copies the values into the referenced array.
+ */
+template <typename T>
+class VecView : public DenseVec<VecView<T>> {
+    T* _data;
+    size_t _size;
+public:
+    typedef size_t size_type;
+    typedef float value_type;
+
+    T& operator[](size_type i) const { return _data[i]; }
+    size_type size() const { return _size; }
+
+    VecView(T* data, size_type size) : _data(data), _size(size) {}
+    VecView(Vec& v) : _data(v.data()), _size(v.size()) {}
+    VecView(Vec const& v) : _data(v.data()), _size(v.size()) {}
+    template <typename U>
+    VecView(VecView<U> const& v) : _data(v.data()), _size(v.size()) {}
+
+    VecView& operator=(VecView const& v) {
+        std::copy(v.data(), v.data() + _size, _data);
+        return *this;
+    }
+
     template <typename E>
-    float dot(VecExpression<E> const& vec) const {
+    void operator=(VecExpression<E> const& vec) {
         E const& v = vec;
-        float x = 0;
-        for (size_type i = 0; i != v.size(); ++i) {
-            x += _data[i] * v[i];
+        for (size_type i = 0; i != _size; ++i) {
+            _data[i] = v[i];
         }
-        return x;
     }
 
-    template <typename E>
-    void operator+=(VecExpression<E> const& vec) {
-        *this = *this + vec;
+    T* data() const { return _data; }
+};
+
+typedef VecView<float> VecRef;
+typedef VecView<const float> ConstVecRef;
+
+/**
+ * Dense row-major matrix of floats, stored in a single buffer. Each row starts on a 64-byte boundary
+ * (rows are padded with zeros to a multiple of 16 floats), so that two rows never share a cache line.
+ * Rows are accessed through views (VecRef), and can be used in vector expressions like any Vec.
+ */
+class Mat {
+public:
+    typedef Vec::size_type size_type;
+    static const size_type alignment = 64; // in bytes
+
+private:
+    float* _data;
+    size_type _rows;
+    size_type _cols;
+    size_type _stride; // distance in floats between the beginning of two consecutive rows
+
+    void allocate(size_type rows, size_type cols) {
+        const size_type padding = alignment / sizeof(float);
+        _rows = rows;
+        _cols = cols;
+        _stride = (cols + padding - 1) / padding * padding;
+        _data = nullptr;
+
+        if (_rows * _stride > 0) {
+            if (allocationHook()) {
+                allocationHook()(_rows * _stride * sizeof(float));
+            }
+            void* ptr = nullptr;
+            if (posix_memalign(&ptr, alignment, _rows * _stride * sizeof(float)) != 0) {
+                throw std::bad_alloc();
+            }
+            _data = static_cast<float*>(ptr);
+            std::fill(_data, _data + _rows * _stride, 0.0f);
+        }
     }
 
-    template <typename E>
-    void operator-=(VecExpression<E> const& vec) {
-        *this = *this - vec;
+public:
+    // called with the size in bytes of each buffer allocated by a Mat (e.g., to count allocations in benchmarks)
+    typedef void (*AllocationHook)(size_t bytes);
+    static AllocationHook& allocationHook() {
+        static AllocationHook hook = nullptr;
+        return hook;
     }
 
-    void operator*=(float alpha) {
-        for (size_type i = 0; i != size(); ++i) {
-            _data[i] *= alpha;
-        }
+    Mat() : _data(nullptr), _rows(0), _cols(0), _stride(0) {}
+    Mat(size_type rows, size_type cols) { allocate(rows, cols); } // zero-initialized
+
+    Mat(Mat const& m) {
+        allocate(m._rows, m._cols);
+        std::copy(m._data, m._data + _rows * _stride, _data);
     }
 
-    void operator/=(float alpha) {
-        for (size_type i = 0; i != size(); ++i) {
-            _data[i] /= alpha;
-        }
+    Mat(Mat&& m) : _data(m._data), _rows(m._rows), _cols(m._cols), _stride(m._stride) {
+        m._data = nullptr;
+        m._rows = m._cols = m._stride = 0;
     }
-    
-    float norm() const {
-        float res = 0;
-        for (size_type i = 0; i != size(); ++i) {
-            res += pow(_data[i], 2);
-        }
-        return sqrt(res);
+
+    Mat& operator=(Mat m) {
+        std::swap(_data, m._data);
+        std::swap(_rows, m._rows);
+        std::swap(_cols, m._cols);
+        std::swap(_stride, m._stride);
+        return *this;
     }
-    
-    const value_type* data() const { return _data.data(); }
-    value_type* data() { return _data.data(); }
+
+    ~Mat() { free(_data); }
+
+    VecRef operator[](size_type i) { return VecRef(_data + i * _stride, _cols); }
+    ConstVecRef operator[](size_type i) const { return ConstVecRef(_data + i * _stride, _cols); }
+
+    size_type size() const { return _rows; } // number of rows
+    size_type rows() const { return _rows; }
+    size_type cols() const { return _cols; }
+    size_type stride() const { return _stride; }
+    bool empty() const { return _rows == 0; }
+
+    float* data() { return _data; }
+    const float* data() const { return _data; }
 };
 
 template <typename E1, typename E2>
@@ -166,8 +354,12 @@ public:
     VecScaled(float alpha, VecExpression<E> const& v) : alpha(alpha), v(v) {}
     Vec::size_type size() const { return v.size(); }
     Vec::value_type operator[](Vec::size_type i) const { return alpha * v[i]; }
+
+    float scale() const { return alpha; }
+    E const& operand() const { return v; }
 };
 
+
 template <typename E1, typename E2>
 VecAddition<E1, E2> const
 operator+(VecExpression<E1> const& u, VecExpression<E2> const& v) {
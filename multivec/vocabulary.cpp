@@ -0,0 +1,58 @@
+#include "vocabulary.hpp"
+#include <stdexcept>
+
+void Vocabulary::clear() {
+    chars.clear();
+    entries.clear();
+    slots.clear();
+}
+
+void Vocabulary::reserve(size_t n_words) {
+    entries.reserve(n_words);
+
+    size_t n_slots = 16;
+    while (n_slots < 2 * n_words) n_slots *= 2;
+    if (n_slots > slots.size()) {
+        rehash(n_slots);
+    }
+}
+
+void Vocabulary::rehash(size_t n_slots) {
+    Slot empty = {0, -1};
+    slots.assign(n_slots, empty);
+    size_t mask = n_slots - 1;
+
+    // the hashes are stored with the words, so the words themselves aren't read again
+    for (int index = 0; index < size(); ++index) {
+        unsigned long long hash = entries[index].hash;
+        size_t i = hash & mask;
+        while (slots[i].index != -1) i = (i + 1) & mask;
+
+        slots[i].tag = static_cast<unsigned int>(hash >> 32);
+        slots[i].index = index;
+    }
+}
+
+int Vocabulary::add(StringView word, int count) {
+    if (2 * (entries.size() + 1) > slots.size()) {
+        rehash(std::max<size_t>(16, 2 * slots.size()));
+    }
+
+    unsigned long long hash = Vocabulary::hash(word);
+    size_t i = findSlot(word, hash);
+    if (slots[i].index != -1) {
+        throw std::runtime_error("duplicate word in vocabulary: " + word.str());
+    }
+
+    Entry entry = {hash, chars.size(), static_cast<int>(word.size()), count};
+    chars.insert(chars.end(), word.begin(), word.end());
+    entries.push_back(entry);
+
+    slots[i].tag = static_cast<unsigned int>(hash >> 32);
+    slots[i].index = static_cast<int>(entries.size()) - 1;
+    return slots[i].index;
+}
+
+size_t Vocabulary::memory() const {
+    return chars.capacity() + entries.capacity() * sizeof(Entry) + slots.capacity() * sizeof(Slot);
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstring>
+#include <vector>
+#include "corpus.hpp"
+
+/**
+ * @brief Vocabulary of a model: maps words to indices in [0, size - 1], and stores the count of each word.
+ * The words are interned one after the other in a single buffer, and indexed by an open-addressing hash
+ * table (linear probing, at most half full). Each slot holds a word index and the upper bits of the
+ * word's 64-bit hash, so that most probes don't need to compare the words.
+ * Lookups take a StringView, so that tokens don't need to be copied into a std::string.
+ */
+class Vocabulary {
+    struct Entry {
+        unsigned long long hash;
+        size_t offset; // position of the word in `chars`
+        int size;
+        int count;
+    };
+
+    struct Slot {
+        unsigned int tag; // upper 32 bits of the hash
+        int index; // -1 for an empty slot
+    };
+
+    std::vector<char> chars;
+    std::vector<Entry> entries; // indexed by word index
+    std::vector<Slot> slots; // the size is a power of 2
+
+    void rehash(size_t n_slots);
+
+    // slot of `word`, or empty slot where it should be inserted
+    size_t findSlot(StringView word, unsigned long long hash) const {
+        size_t mask = slots.size() - 1;
+        unsigned int tag = static_cast<unsigned int>(hash >> 32);
+
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.index == -1) {
+                return i;
+            }
+            if (slot.tag == tag) {
+                const Entry& entry = entries[slot.index];
+                if (entry.size == word.size() && memcmp(chars.data() + entry.offset, word.data(), word.size()) == 0) {
+                    return i;
+                }
+            }
+        }
+    }
+
+public:
+    // FNV-1a with a final mix, so that the lower bits (used for the slot position) depend on all the characters
+    static unsigned long long hash(StringView word) {
+        unsigned long long h = 14695981039346656037ULL;
+        for (const char* p = word.begin(); p != word.end(); ++p) {
+            h = (h ^ static_cast<unsigned char>(*p)) * 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    int size() const { return static_cast<int>(entries.size()); }
+    bool empty() const { return entries.empty(); }
+
+    void clear();
+    void reserve(size_t n_words);
+
+    /**
+     * @return index of `word`, or -1 if it isn't in the vocabulary
+     */
+    int find(StringView word) const {
+        if (slots.empty()) {
+            return -1;
+        }
+        return slots[findSlot(word, hash(word))].index;
+    }
+
+    /**
+     * @brief Add a word that isn't in the vocabulary yet (throws otherwise).
+     * @return index of the new word (i.e., previous size of the vocabulary)
+     */
+    int add(StringView word, int count);
+
+    StringView word(int index) const { return StringView(chars.data() + entries[index].offset, entries[index].size); }
+    int count(int index) const { return entries[index].count; }
+
+    size_t memory() const; // size in bytes
+};
@@ -7,98 +7,115 @@
 #include <algorithm>
 #include <iomanip>
 #include <math.h>
+#include <stdlib.h>
+#include <functional>
+#include "../multivec/corpus.hpp" // tokenizer (same as in training)
+#include "../multivec/kernels.hpp"
 
 using namespace std;
 typedef vector<float> vec;
 
-vector<string> split(const string& sentence) {
-    istringstream iss(sentence);
-    vector<string> words;
-    string word;
-
-    while (iss >> word) {
-        words.push_back(word);
-    }
-
-    return words;
-}
-
 inline string lower(string s) {
     std::transform(s.begin(), s.end(), s.begin(), ::tolower);
     return s;
 }
 
+/**
+ * Embeddings of the vocabulary, stored as the rows of a single matrix, so that the similarities of a block of
+ * questions with all the words are one matrix product (see kernels::gemm, which may call BLAS).
+ */
+struct Embeddings {
+    vector<string> words;
+    map<string, int> indices;
+    vector<float> weights; // row i is the embedding of words[i]
+    size_t size;
+
+    float* row(int index) { return weights.data() + index * size; }
+    const float* row(int index) const { return weights.data() + index * size; }
+};
+
 void evaluateTopic(const string& topic, const vector<string>& lines,
-    const map<string, vec>& embeddings, pair<int, int>* res) {
+    const Embeddings& embeddings, pair<int, int>* res) {
 
-    int total = 0, correct = 0;
+    // the four words of each question
+    vector<vector<int>> questions;
 
     for (auto line_it = lines.begin(); line_it != lines.end(); ++line_it) {
-        vector<string> words = split(*line_it);
-        transform(words.begin(), words.end(), words.begin(), lower);
-
-        auto it1 = embeddings.find(words[0]);
-        auto it2 = embeddings.find(words[1]);
-        auto it3 = embeddings.find(words[2]);
-        auto it4 = embeddings.find(words[3]);
+        vector<int> question;
+        StringView text(*line_it), token;
+        while (nextToken(text, token)) {
+            auto it = embeddings.indices.find(lower(token.str()));
+            question.push_back(it == embeddings.indices.end() ? -1 : it->second);
+        }
 
         // skip the query if one of the four words is absent from the vocabulary
-        if (it1 == embeddings.end() || it2 == embeddings.end() ||
-            it3 == embeddings.end() || it4 == embeddings.end()) {
+        if (question.size() < 4 || std::count(question.begin(), question.begin() + 4, -1) > 0) {
             continue;
         }
+        questions.push_back(question);
+    }
 
-        // w4 = w2 - w1 + w3 (find w4)
-        vec v = it2->second;
-        for (int c = 0; c < v.size(); ++c) {
-            v[c] += it3->second[c] - it1->second[c];
-        }
+    size_t n_words = embeddings.words.size(), size = embeddings.size;
+    size_t block_size = max<size_t>(1, min<size_t>(64, (1 << 22) / max<size_t>(n_words, 1)));
+    vector<float> queries(block_size * size);
+    vector<float> similarities(block_size * n_words);
+    int total = 0, correct = 0;
 
-        // find the closest word
-        float similarity = 0;
-        string closest_word;
+    for (size_t start = 0; start < questions.size(); start += block_size) {
+        size_t n = min(block_size, questions.size() - start);
 
-        for (auto it = embeddings.begin(); it != embeddings.end(); ++it) {
-            // cheating...
-            if (it->first == words[0] || it->first == words[1] || it->first == words[2]) {
-                continue;
+        // w4 = w2 - w1 + w3 (find w4)
+        for (size_t q = 0; q < n; ++q) {
+            const vector<int>& words = questions[start + q];
+            const float* v1 = embeddings.row(words[0]);
+            const float* v2 = embeddings.row(words[1]);
+            const float* v3 = embeddings.row(words[2]);
+            for (size_t c = 0; c < size; ++c) {
+                queries[q * size + c] = v2[c] + v3[c] - v1[c];
             }
+        }
 
-            float sim = 0;
-            for (int c = 0; c < v.size(); ++c) {
-                sim += it->second[c] * v[c];
-            }
+        // dot products of the queries with all the words
+        kernels::gemm(false, true, n, n_words, size, 1, queries.data(), size, embeddings.weights.data(), size,
+                      0, similarities.data(), n_words);
 
-            if (sim >= similarity) {
-                closest_word = it->first;
-                similarity = sim;
+        // find the closest word
+        for (size_t q = 0; q < n; ++q) {
+            const vector<int>& words = questions[start + q];
+            const float* sims = similarities.data() + q * n_words;
+            float similarity = 0;
+            int closest_word = -1;
+
+            for (int i = 0; i < n_words; ++i) {
+                // cheating...
+                if (i == words[0] || i == words[1] || i == words[2]) {
+                    continue;
+                }
+
+                if (sims[i] >= similarity) {
+                    closest_word = i;
+                    similarity = sims[i];
+                }
             }
-        }
 
-        if (closest_word == words[3]) {
-            ++correct;
+            if (closest_word == words[3]) {
+                ++correct;
+            }
+            ++total;
         }
-        ++total;
     }
 
     //return pair<int, int>(correct, total);
     *res = pair<int, int>(correct, total);
 }
 
-void computeAccuracy(istream& infile, map<string, vec>& embeddings, bool verbose)
+void computeAccuracy(istream& infile, Embeddings& embeddings, bool verbose)
 {
     // normalize
-    for (auto it = embeddings.begin(); it != embeddings.end(); ++it) {
-        float norm = 0;
-        for (int c = 0; c < it->second.size(); ++c) {
-            float x = it->second[c];
-            norm += x * x;
-        }
-        norm = sqrt(norm);
-
-        for (int c = 0; c < it->second.size(); ++c) {
-            it->second[c] /= norm;
-        }
+    for (int i = 0; i < embeddings.words.size(); ++i) {
+        float* v = embeddings.row(i);
+        float norm = sqrt(kernels::dot(v, v, embeddings.size));
+        kernels::scal(1 / norm, v, embeddings.size);
     }
 
     map<string, vector<string>> topics;
@@ -117,7 +134,7 @@ void computeAccuracy(istream& infile, map<string, vec>& embeddings, bool verbose
     vector<thread> threads;
     int i = 0;
     for (auto it = topics.begin(); it != topics.end(); ++it, ++i) {
-        threads.push_back(thread(evaluateTopic, it->first, it->second, embeddings, &results[i]));
+        threads.push_back(thread(evaluateTopic, it->first, it->second, std::cref(embeddings), &results[i]));
     }
 
     for (auto it = threads.begin(); it != threads.end(); ++it) {
@@ -157,7 +174,7 @@ void computeAccuracy(istream& infile, map<string, vec>& embeddings, bool verbose
 }
 
 void computeAccuracy(const string& model_filename, istream& infile, long long max_vocabulary_size) {
-    map<string, vec> embeddings;
+    Embeddings embeddings;
     ifstream model_file(model_filename);
 
     if (!model_file.is_open()) {
@@ -176,19 +193,29 @@ void computeAccuracy(const string& model_filename, istream& infile, long long ma
         words = min(max_vocabulary_size, words);
     }
 
+    embeddings.size = size;
+    embeddings.weights.reserve(words * size);
+
+    vector<StringView> tokens;
     for (size_t i = 0; i < words; ++i) {
         vec v(size);
-        int j = 0;
 
         getline(model_file, line);
-        vector<string> tokens = split(line);
-        string word = tokens.front();
+        tokenize(line, tokens);
+        if (tokens.size() < size + 1) {
+            throw runtime_error("invalid line in file " + model_filename);
+        }
 
+        // the values are followed by a space or by the end of the line, so strtof stops at the right place
         for (size_t j = 0; j < size; ++j) {
-            v[j] = std::stof(tokens[j + 1]);
+            v[j] = strtof(tokens[j + 1].data(), nullptr);
+        }
+
+        string word = tokens.front().str();
+        if (embeddings.indices.insert({word, static_cast<int>(embeddings.words.size())}).second) {
+            embeddings.words.push_back(word);
+            embeddings.weights.insert(embeddings.weights.end(), v.begin(), v.end());
         }
-        
-        embeddings.insert({word, v});
     }
 
     computeAccuracy(infile, embeddings, true);